@@ -3,7 +3,6 @@
 #include <boost/json.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 #include <boost/range/adaptor/map.hpp>
-#include <boost/range/algorithm/transform.hpp>
 #include <string>
 #include <string_view>
 #include <functional>
@@ -13,8 +12,28 @@
 #include <fstream>
 #include <filesystem>
 #include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <sstream>
 #include <unordered_map>
+#include <chrono>
+#include <map>
+#include <list>
+#include <set>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#if __has_include(<sys/uio.h>)
+#include <sys/uio.h>
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#define BOOST_MUSTACHE_HAS_COROUTINES
+#endif
 
 namespace boost::mustache {
 // Partial resolver interface
@@ -25,38 +44,77 @@ public:
 };
 
 class Renderer;
+class Context;
 
-// Context base class
-class Context {
-public:
-    inline explicit Context(std::shared_ptr<PartialResolver> resolver = nullptr) : m_partialResolver(std::move(resolver)) {}
+using RenderFunction = std::function<std::string(std::string_view, Renderer *, Context *)>;
 
-    virtual ~Context() = default;
-    virtual std::string stringValue(std::string_view key) const = 0;
-    virtual bool isFalse(std::string_view key) const = 0;
-    virtual size_t listCount(std::string_view key) const = 0;
-    virtual void push(std::string_view key, int index = -1) = 0;
-    virtual void pop() = 0;
+class Section;
+class OutputSink;
 
-    std::shared_ptr<PartialResolver> partialResolver() const { return m_partialResolver; }
+// Receives the compiled section instead of its text, so the body renders without being parsed again
+using SectionFunction = std::function<void(const Section &, OutputSink &)>;
 
-    virtual bool canEval(std::string_view) const { return false; }
+// Maps the rendered section body to the output, depending on nothing else, so results can be memoized
+using PureFunction = std::function<std::string(std::string_view)>;
 
-    virtual std::string eval(std::string_view, std::string_view, Renderer *) { return {}; }
+// Registered section function, taking either the section text, the compiled section or the rendered body
+struct Function {
+    RenderFunction text;
+    SectionFunction section;
+    PureFunction pure;
+};
 
-    std::string partialValue(std::string_view key) const
+// Function handle resolved ahead of rendering, valid while the registry version is unchanged.
+// Pinned slots come from a template's own function set and stay valid regardless of the registry.
+struct FunctionSlot {
+    const Function *function{nullptr};
+    uint64_t version{0};
+    bool pinned{false};
+};
+
+// Set of section functions attached to a context or a compiled template, consulted before the global registry.
+// Not synchronized, finish registering before rendering with the set from several threads.
+class FunctionSet {
+public:
+    void registerFunction(std::string name, RenderFunction func) { add(std::move(name), {std::move(func), {}, {}}); }
+    void registerSectionFunction(std::string name, SectionFunction func) { add(std::move(name), {{}, std::move(func), {}}); }
+    void registerPureFunction(std::string name, PureFunction func) { add(std::move(name), {{}, {}, std::move(func)}); }
+
+    const Function *find(std::string_view name) const
     {
-        if (!m_partialResolver)
-            return {};
-        return m_partialResolver->getPartial(key);
+        auto it = m_functions.find(name);
+        return it != m_functions.end() ? &it->second->function : nullptr;
     }
 
+    bool empty() const { return m_functions.empty(); }
+    size_t size() const { return m_functions.size(); }
+
 private:
-    std::shared_ptr<PartialResolver> m_partialResolver;
-};
+    struct Entry {
+        std::string name;
+        Function function;
+    };
 
-using RenderFunction = std::function<std::string(std::string_view, Renderer *, Context *)>;
+    // Registering a name again adds a new entry rather than assigning, so handles and cached results keyed by
+    // the superseded function keep referring to it
+    void add(std::string name, Function function)
+    {
+        m_entries.push_back(std::make_unique<const Entry>(Entry{std::move(name), std::move(function)}));
+        const Entry *entry = m_entries.back().get();
+        m_functions.erase(entry->name);
+        m_functions.emplace(entry->name, entry);
+    }
+
+    // Keys view the names owned by the entries
+    std::unordered_map<std::string_view, const Entry *> m_functions;
+    // Every entry ever registered, superseded ones included
+    std::vector<std::unique_ptr<const Entry>> m_entries;
+};
 
+// Registry of section functions. Every registration publishes a new immutable table through an atomic pointer,
+// so lookups take no lock and may run concurrently with registration. Superseded tables and entries are kept for
+// the lifetime of the registry, which makes function handles valid as long as it lives; registration is expected
+// to be rare, typically at startup.
 class FunctionRegistry {
 public:
     static FunctionRegistry &instance()
@@ -65,14 +123,83 @@ public:
         return registry;
     }
 
-    void registerFunction(std::string name, RenderFunction func) { m_functions[std::move(name)] = std::move(func); }
+    void registerFunction(std::string name, RenderFunction func) { add(std::move(name), {std::move(func), {}, {}}); }
+    void registerSectionFunction(std::string name, SectionFunction func) { add(std::move(name), {{}, std::move(func), {}}); }
+    void registerPureFunction(std::string name, PureFunction func) { add(std::move(name), {{}, {}, std::move(func)}); }
 
-    bool hasFunction(const std::string &name) const { return m_functions.find(name) != m_functions.end(); }
+    // Returns null if no function is registered under name. A slot resolved at the current version is used as is.
+    const Function *find(std::string_view name, const FunctionSlot *slot = nullptr) const
+    {
+        if (slot && (slot->pinned || slot->version == m_version.load(std::memory_order_acquire))) {
+            return slot->function;
+        }
+        const Table *table = snapshot();
+        auto it = table->functions.find(name);
+        return it != table->functions.end() ? &it->second->function : nullptr;
+    }
+
+    FunctionSlot resolve(std::string_view name) const
+    {
+        const Table *table = snapshot();
+        auto it = table->functions.find(name);
+        return {it != table->functions.end() ? &it->second->function : nullptr, table->version};
+    }
+
+    uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+
+    bool hasFunction(std::string_view name) const { return find(name) != nullptr; }
 
-    const RenderFunction &getFunction(const std::string &name) const { return m_functions.at(name); }
+    // Text function registered under name
+    const RenderFunction &getFunction(std::string_view name) const
+    {
+        const Function *function = find(name);
+        if (function && function->text) {
+            return function->text;
+        }
+        throw std::out_of_range("boost::mustache: function not registered");
+    }
 
 private:
-    std::unordered_map<std::string, RenderFunction> m_functions;
+    struct Entry {
+        std::string name;
+        Function function;
+    };
+
+    // Keys view the names owned by the entries
+    struct Table {
+        uint64_t version{1};
+        std::unordered_map<std::string_view, const Entry *> functions;
+    };
+
+    FunctionRegistry() { m_table.store(m_tables.emplace_back(std::make_unique<const Table>()).get()); }
+
+    const Table *snapshot() const { return m_table.load(std::memory_order_acquire); }
+
+    void add(std::string name, Function function)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        const Table *current = snapshot();
+
+        m_entries.push_back(std::make_unique<const Entry>(Entry{std::move(name), std::move(function)}));
+        const Entry *entry = m_entries.back().get();
+        auto table = std::make_unique<Table>();
+        table->version = current->version + 1;
+        table->functions = current->functions;
+        table->functions[entry->name] = entry;
+
+        const uint64_t version = table->version;
+        m_table.store(m_tables.emplace_back(std::move(table)).get(), std::memory_order_release);
+        m_version.store(version, std::memory_order_release);
+    }
+
+    std::atomic<const Table *> m_table{nullptr};
+    // Every table ever published, as readers may still be looking into a superseded one
+    std::vector<std::unique_ptr<const Table>> m_tables;
+    // Slots compare against this instead of the table, so resolved lookups never touch the snapshot
+    std::atomic<uint64_t> m_version{1};
+    // Every entry ever registered, superseded ones included, only appended to under the write mutex
+    std::vector<std::unique_ptr<const Entry>> m_entries;
+    std::mutex m_writeMutex;
 };
 
 inline void registerFunction(std::string name, RenderFunction func)
@@ -80,369 +207,865 @@ inline void registerFunction(std::string name, RenderFunction func)
     FunctionRegistry::instance().registerFunction(std::move(name), std::move(func));
 }
 
-// PropertyTree context implementation
-class PropertyTreeContext : public Context {
+inline void registerSectionFunction(std::string name, SectionFunction func)
+{
+    FunctionRegistry::instance().registerSectionFunction(std::move(name), std::move(func));
+}
+
+inline void registerPureFunction(std::string name, PureFunction func)
+{
+    FunctionRegistry::instance().registerPureFunction(std::move(name), std::move(func));
+}
+
+// Bounded least recently used cache of pure function results, keyed by function and rendered input.
+// Functions are identified by address, clear a cache shared across renders when dropping a function set.
+class FunctionCache {
 public:
-    using EvalFunction = std::function<std::string(std::string_view, Renderer *, Context *)>;
+    explicit FunctionCache(size_t capacity = 1024) : m_capacity(capacity) {}
 
-    explicit PropertyTreeContext(const boost::property_tree::ptree &root, std::shared_ptr<PartialResolver> resolver = nullptr)
-        : Context(std::move(resolver))
+    std::optional<std::string> find(const Function *function, std::string_view input)
     {
-        m_contextStack.push_back(root);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(Key{function, input});
+        if (it == m_index.end()) {
+            ++m_misses;
+            return std::nullopt;
+        }
+        ++m_hits;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->output;
     }
 
-    boost::property_tree::ptree getValue(std::string_view key) const
+    void insert(const Function *function, std::string input, std::string output)
     {
-        if (key == ".") {
-            return m_contextStack.back();
+        if (m_capacity == 0) {
+            return;
         }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_index.find(Key{function, input}) != m_index.end()) {
+            return;
+        }
+        if (m_entries.size() == m_capacity) {
+            m_index.erase(Key{m_entries.back().function, m_entries.back().input});
+            m_entries.pop_back();
+        }
+        m_entries.push_front({function, std::move(input), std::move(output)});
+        m_index.emplace(Key{function, m_entries.front().input}, m_entries.begin());
+    }
 
-        std::string keyStr{key};
-
-        for (const auto &it : boost::adaptors::reverse(m_contextStack)) {
-            if (auto childIt = it.get_child_optional(keyStr)) {
-                return *childIt;
-            }
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_index.clear();
+        m_entries.clear();
+    }
 
-            continue;
-        }
-        return {};
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.size();
     }
 
-    bool isFalse(std::string_view key) const override
+    size_t capacity() const { return m_capacity; }
+
+    size_t hits() const
     {
-        auto value = getValue(key);
-        try {
-            bool boolValue = value.get_value<bool>();
-            return !boolValue;
-        } catch (const boost::property_tree::ptree_bad_data &) {
-            try {
-                std::string stringValue = value.get_value<std::string>();
-                std::string lowerStringValue = stringValue;
-                boost::range::transform(lowerStringValue, lowerStringValue.begin(), ::tolower);
-                return (lowerStringValue == "false" || stringValue.empty());
-            } catch (...) {
-                return true;
-            }
-        } catch (...) {
-            return true;
-        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
     }
 
-    std::string stringValue(std::string_view key) const override
+    size_t misses() const
     {
-        auto value = getValue(key);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
 
-        if (auto doubleValue = value.get_value_optional<double>(); doubleValue.has_value()) {
-            std::ostringstream oss;
-            oss.precision(6); // Default precision like fmt
+private:
+    struct Entry {
+        const Function *function;
+        std::string input;
+        std::string output;
+    };
 
-            const auto dvalue = *doubleValue;
+    // The input views the string owned by the entry
+    struct Key {
+        const Function *function;
+        std::string_view input;
 
-            if (std::floor(dvalue) == dvalue) {
-                oss << std::fixed << std::setprecision(0) << dvalue;
-            }
-            else {
-                oss << std::defaultfloat << dvalue;
-            }
+        bool operator==(const Key &other) const { return function == other.function && input == other.input; }
+    };
 
-            return oss.str();
+    struct KeyHash {
+        size_t operator()(const Key &key) const
+        {
+            return std::hash<std::string_view>()(key.input) ^ (std::hash<const void *>()(key.function) * 31);
         }
+    };
 
-        if (auto floatValue = value.get_value_optional<float>(); floatValue.has_value()) {
-            std::ostringstream oss;
-            oss.precision(6);
-            oss << std::defaultfloat << *floatValue;
-            return oss.str();
-        }
+    size_t m_capacity;
+    std::list<Entry> m_entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+    size_t m_hits{0};
+    size_t m_misses{0};
+    mutable std::mutex m_mutex;
+};
 
-        if (auto strValue = value.get_value_optional<std::string>()) {
-            return *strValue;
+inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+// Building blocks of the exact data encodings contexts produce for section memoization
+inline void encodeSize(std::string &out, uint64_t size)
+{
+    char bytes[sizeof(size)];
+    std::memcpy(bytes, &size, sizeof(size));
+    out.append(bytes, sizeof(bytes));
+}
+
+inline void encodeString(std::string &out, std::string_view value)
+{
+    encodeSize(out, value.size());
+    out.append(value);
+}
+
+// Output of sections opted in by key, keyed by the compiled section and an exact encoding of the data it was
+// rendered from, evicting the least recently used output once the byte budget is exceeded. Only memoize sections
+// whose body depends on nothing but the section's own data, as keys missing from it resolve in enclosing frames.
+class SectionCache {
+public:
+    explicit SectionCache(size_t byteBudget = 1 << 20) : m_byteBudget(byteBudget) {}
+
+    // Configures the keys before the cache is first attached to a renderer, after which the set is read
+    // without locking and memoizing another key throws
+    void memoize(std::string key)
+    {
+        if (m_attached.load(std::memory_order_acquire)) {
+            throw std::logic_error("boost::mustache: section cache already in use");
         }
+        m_keys.insert(std::move(key));
+    }
 
-        return {};
+    bool memoizes(std::string_view key) const { return m_keys.find(key) != m_keys.end(); }
+
+    std::optional<std::string> find(uint64_t templateId, size_t position, std::string_view data)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find({templateId, position, data});
+        if (it == m_index.end()) {
+            ++m_misses;
+            return std::nullopt;
+        }
+        ++m_hits;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->output;
     }
 
-    void push(std::string_view key, int index = -1) override
+    // The encoded data counts against the budget along with the output
+    void insert(uint64_t templateId, size_t position, std::string data, std::string output)
     {
-        auto value = getValue(key);
-        if (value.empty()) {
-            m_contextStack.emplace_back();
+        const size_t size = data.size() + output.size();
+        if (size > m_byteBudget) {
             return;
         }
-
-        if (index >= 0) {
-            int currentIndex = 0;
-            for (auto &val : value | boost::adaptors::map_values) {
-                if (currentIndex == index) {
-                    m_contextStack.push_back(val);
-                    return;
-                }
-                currentIndex++;
-            }
-            m_contextStack.emplace_back();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_index.find({templateId, position, data}) != m_index.end()) {
+            return;
         }
-        else {
-            m_contextStack.push_back(value);
+        m_bytes += size;
+        m_entries.push_front({templateId, position, std::move(data), std::move(output)});
+        const Entry &entry = m_entries.front();
+        m_index.emplace(Key{templateId, position, entry.data}, m_entries.begin());
+        while (m_bytes > m_byteBudget) {
+            const Entry &last = m_entries.back();
+            m_bytes -= last.data.size() + last.output.size();
+            m_index.erase({last.templateId, last.position, last.data});
+            m_entries.pop_back();
         }
     }
 
-    void pop() override
+    void clear()
     {
-        if (!m_contextStack.empty()) {
-            m_contextStack.pop_back();
-        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_index.clear();
+        m_entries.clear();
+        m_bytes = 0;
     }
 
-    size_t listCount(std::string_view key) const override
+    size_t bytes() const
     {
-        auto value = getValue(key);
-        return value.size();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_bytes;
     }
 
-    bool canEval(std::string_view key) const override { return FunctionRegistry::instance().hasFunction(std::string(key)); }
+    size_t byteBudget() const { return m_byteBudget; }
 
-    std::string eval(std::string_view key, std::string_view text, Renderer *renderer) override
+    size_t hits() const
     {
-        if (FunctionRegistry::instance().hasFunction(std::string(key))) {
-            return FunctionRegistry::instance().getFunction(std::string(key))(text, renderer, this);
-        }
-        return {};
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
     }
 
-private:
-    std::vector<boost::property_tree::ptree> m_contextStack;
-};
-
-// File-based partial resolver
-class PartialFileLoader : public PartialResolver {
-public:
-    explicit PartialFileLoader(std::string_view basePath) : m_basePath(basePath) {}
-
-    std::string getPartial(std::string_view name) override
+    size_t misses() const
     {
-        std::string nameStr{name};
-        if (m_cache.count(nameStr)) {
-            return m_cache[nameStr];
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
+
+private:
+    // The data views the encoding owned by the entry, compared in full so that entries never match on a hash alone
+    struct Key {
+        uint64_t templateId;
+        size_t position;
+        std::string_view data;
+
+        bool operator==(const Key &other) const
+        {
+            return templateId == other.templateId && position == other.position && data == other.data;
         }
+    };
 
-        auto path = std::filesystem::path(m_basePath) / (std::string(name) + ".mustache");
-        std::ifstream file(path);
-        if (file) {
-            std::stringstream buffer;
-            buffer << file.rdbuf();
-            auto content = buffer.str();
-            m_cache[nameStr] = content;
-            return content;
+    struct KeyHash {
+        size_t operator()(const Key &key) const
+        {
+            return static_cast<size_t>(
+                    hashCombine(hashCombine(key.templateId, key.position), std::hash<std::string_view>()(key.data)));
         }
-        return {};
-    }
+    };
 
-private:
-    std::string m_basePath;
-    std::unordered_map<std::string, std::string> m_cache;
+    struct Entry {
+        uint64_t templateId;
+        size_t position;
+        std::string data;
+        std::string output;
+    };
+
+    friend class Renderer;
+
+    size_t m_byteBudget;
+    size_t m_bytes{0};
+    std::set<std::string, std::less<>> m_keys;
+    std::atomic<bool> m_attached{false};
+    std::list<Entry> m_entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+    size_t m_hits{0};
+    size_t m_misses{0};
+    mutable std::mutex m_mutex;
 };
 
-// Tag structure
-struct Tag {
-    enum class type { Null, Value, SectionStart, InvertedSectionStart, SectionEnd, Partial, Comment, SetDelimiter };
+// Whether a string value reads as false: empty, or "false" in any case. Compared in place, without a lowercased copy.
+inline bool isFalseString(std::string_view value)
+{
+    constexpr std::string_view falseString = "false";
+    return value.empty()
+        || (value.size() == falseString.size()
+                && std::equal(value.begin(), value.end(), falseString.begin(),
+                        [](char c, char lower) { return std::tolower(static_cast<unsigned char>(c)) == lower; }));
+}
 
-    enum class escape_mode { Escape, Unescape, Raw };
+// Typed view of a value, letting the renderer format numbers and escape strings straight into the sink.
+// Strings view data owned by the context, valid until it next pushes or pops a frame.
+struct ValueView {
+    enum class type { Null, String, Int, Uint, Double, Bool };
 
     type type{type::Null};
-    std::string key;
-    size_t start{0};
-    size_t end{0};
-    escape_mode escapeMode{escape_mode::Escape};
-    size_t indentation{0};
+    std::string_view string;
+    int64_t integer{0};
+    uint64_t unsignedInteger{0};
+    double real{0};
+    bool boolean{false};
 };
 
-class Renderer {
+// A key looked up once for a section tag, then reused for its list count, truthiness and pushes. Contexts
+// overriding Context::resolve keep where the value was found, valid while the frames below the section stay
+// the same; by default the handle only carries the key.
+struct ResolvedKey {
+    std::string_view key;
+    const void *value{nullptr};
+    size_t frame{0};
+};
+
+// Hash of a lookup key, computed once per tag when a template is compiled
+inline size_t keyHash(std::string_view key)
+{
+    return std::hash<std::string_view>()(key);
+}
+
+// Key of a compiled tag along with its keyHash()
+struct HashedKey {
+    std::string_view key;
+    size_t hash{0};
+};
+
+// Context base class
+class Context {
 public:
-    Renderer() : m_errorPos(std::nullopt), m_defaultTagStartMarker("{{"), m_defaultTagEndMarker("}}")
-    {
-        m_tagStartMarker = m_defaultTagStartMarker;
-        m_tagEndMarker = m_defaultTagEndMarker;
-    }
+    inline explicit Context(std::shared_ptr<PartialResolver> resolver = nullptr) : m_partialResolver(std::move(resolver)) {}
 
-    std::string_view error() const { return m_error; }
-    std::optional<size_t> errorPos() const { return m_errorPos; }
-    std::string_view errorPartial() const { return m_errorPartial; }
+    virtual ~Context() = default;
+    virtual std::string stringValue(std::string_view key) const = 0;
 
-    void setTagMarkers(std::string_view startMarker, std::string_view endMarker)
+    // Typed value for key, rendered the same as stringValue. Null if the context only provides strings.
+    virtual std::optional<ValueView> typedValue(std::string_view) const { return std::nullopt; }
+
+    virtual bool isFalse(std::string_view key) const = 0;
+    virtual size_t listCount(std::string_view key) const = 0;
+    virtual void push(std::string_view key, int index = -1) = 0;
+    virtual void pop() = 0;
+
+    virtual ResolvedKey resolve(std::string_view key) const { return {key}; }
+
+    // Lookups the renderer makes with a tag's precomputed hash. Contexts that hash keys override these along
+    // with the lookups by key, the others get the key alone.
+    virtual std::optional<ValueView> typedValue(const HashedKey &key) const { return typedValue(key.key); }
+    virtual bool isFalse(const HashedKey &key) const { return isFalse(key.key); }
+    virtual ResolvedKey resolve(const HashedKey &key) const { return resolve(key.key); }
+    virtual size_t resolvedCount(const ResolvedKey &resolved) const { return listCount(resolved.key); }
+    virtual bool resolvedFalse(const ResolvedKey &resolved) const { return isFalse(resolved.key); }
+    virtual void pushResolved(const ResolvedKey &resolved, int index = -1) { push(resolved.key, index); }
+
+    std::shared_ptr<PartialResolver> partialResolver() const { return m_partialResolver; }
+
+    // Function rendering sections with this key, null if there is none. Functions attached to the context
+    // come first, then the template's (through the slot its compiled template resolved), then the registry.
+    virtual const Function *function(std::string_view key, const FunctionSlot *slot = nullptr) const
     {
-        m_defaultTagStartMarker = std::string(startMarker);
-        m_defaultTagEndMarker = std::string(endMarker);
+        if (m_functions) {
+            if (const Function *function = m_functions->find(key)) {
+                return function;
+            }
+        }
+        return FunctionRegistry::instance().find(key, slot);
     }
 
-    std::string render(const std::string_view templ, Context *context)
+    void setFunctions(std::shared_ptr<const FunctionSet> functions) { m_functions = std::move(functions); }
+    std::shared_ptr<const FunctionSet> functions() const { return m_functions; }
+
+    // While set, the data paths of lookups are appended to paths, dot separated with list indexes as components.
+    // Lookups record every frame they probe, since a key added to an inner frame would shadow an outer one.
+    void trackDependencies(std::vector<std::string> *paths) { m_dependencies = paths; }
+    virtual bool supportsDependencies() const { return false; }
+
+    // Exact encoding of the data in the innermost frame, for section output memoization. Null if not supported.
+    virtual std::optional<std::string> frameKey() const { return std::nullopt; }
+
+    // Forward iteration for lists whose length is not known up front. Sections over iterable keys render
+    // through next, which pushes the following element and returns true, or returns false at the end of the
+    // list; each element is popped like any other frame before the next one is requested.
+    virtual bool iterable(std::string_view) const { return false; }
+    virtual bool next(std::string_view) { return false; }
+
+    // Custom evaluation for section keys that are not registered functions
+    virtual bool canEval(std::string_view) const { return false; }
+
+    virtual std::string eval(std::string_view, std::string_view, Renderer *) { return {}; }
+
+    std::string partialValue(std::string_view key) const
     {
-        m_error.clear();
-        m_errorPos = std::nullopt;
-        m_errorPartial.clear();
-        m_tagStartMarker = m_defaultTagStartMarker;
-        m_tagEndMarker = m_defaultTagEndMarker;
-        return render(templ, 0, templ.length(), context);
+        if (!m_partialResolver)
+            return {};
+        return m_partialResolver->getPartial(key);
     }
 
-private:
-    static std::string escapeHtml(std::string_view input)
+    // Key lookups performed by this context since construction
+    size_t lookupCount() const { return m_lookups; }
+    size_t lookupMissCount() const { return m_lookupMisses; }
+
+protected:
+    void countLookup(bool found) const
     {
-        std::string result;
-        result.reserve(input.size());
-        for (char c : input) {
-            switch (c) {
-            case '&':
-                result += "&amp;";
-                break;
-            case '<':
-                result += "&lt;";
-                break;
-            case '>':
-                result += "&gt;";
-                break;
-            case '"':
-                result += "&quot;";
-                break;
-            default:
-                result += c;
-            }
+        ++m_lookups;
+        if (!found) {
+            ++m_lookupMisses;
         }
-        return result;
     }
 
-    static std::string unescapeHtml(std::string_view escaped)
+    std::vector<std::string> *dependencies() const { return m_dependencies; }
+
+    static std::string joinPath(std::string_view base, std::string_view key)
     {
-        std::string result{escaped};
-        static const std::vector<std::pair<std::string_view, char>> replacements = {
-                {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&amp;", '&'}};
-        for (const auto &[pattern, replacement] : replacements) {
-            size_t pos = 0;
-            while ((pos = result.find(pattern, pos)) != std::string::npos) {
-                result.replace(pos, pattern.length(), 1, replacement);
-                pos += 1;
-            }
+        std::string path;
+        path.reserve(base.size() + key.size() + 1);
+        path += base;
+        if (!base.empty()) {
+            path += '.';
         }
-        return result;
+        path += key;
+        return path;
     }
 
-    std::string render(std::string_view templ, size_t startPos, size_t endPos, Context *context)
-    {
-        std::string output;
-        size_t lastTagEnd = startPos;
+private:
+    std::shared_ptr<PartialResolver> m_partialResolver;
+    std::shared_ptr<const FunctionSet> m_functions;
+    std::vector<std::string> *m_dependencies{nullptr};
+    mutable size_t m_lookups{0};
+    mutable size_t m_lookupMisses{0};
+};
 
-        while (!m_errorPos) {
-            Tag tag = findTag(templ, lastTagEnd, endPos);
-            if (tag.type == Tag::type::Null) {
-                output.append(templ.substr(lastTagEnd, endPos - lastTagEnd));
-                break;
+// PropertyTree context implementation
+class PropertyTreeContext : public Context {
+public:
+    using EvalFunction = std::function<std::string(std::string_view, Renderer *, Context *)>;
+
+    // Renders a copy of root. Frames point into it, lookups and pushes copy nothing.
+    explicit PropertyTreeContext(const boost::property_tree::ptree &root, std::shared_ptr<PartialResolver> resolver = nullptr)
+        : Context(std::move(resolver)), m_root(std::make_unique<boost::property_tree::ptree>(root))
+    {
+        m_contextStack.push_back(m_root.get());
+    }
+
+    boost::property_tree::ptree getValue(std::string_view key) const
+    {
+        size_t frame;
+        const boost::property_tree::ptree *value = lookup(key, frame);
+        return value ? *value : boost::property_tree::ptree();
+    }
+
+    bool isFalse(std::string_view key) const override
+    {
+        size_t frame;
+        return isFalseTree(lookup(key, frame));
+    }
+
+    std::string stringValue(std::string_view key) const override
+    {
+        size_t frame;
+        const boost::property_tree::ptree *value = lookup(key, frame);
+        if (!value) {
+            return {};
+        }
+
+        if (auto doubleValue = value->get_value_optional<double>(); doubleValue.has_value()) {
+            std::ostringstream oss;
+            oss.precision(6); // Default precision like fmt
+
+            const auto dvalue = *doubleValue;
+
+            if (std::floor(dvalue) == dvalue) {
+                oss << std::fixed << std::setprecision(0) << dvalue;
+            }
+            else {
+                oss << std::defaultfloat << dvalue;
             }
 
-            output.append(templ.substr(lastTagEnd, tag.start - lastTagEnd));
+            return oss.str();
+        }
 
-            switch (tag.type) {
-            case Tag::type::Value: {
-                std::string value = context->stringValue(tag.key);
-                if (tag.escapeMode == Tag::escape_mode::Escape) {
-                    value = escapeHtml(value);
-                }
-                else if (tag.escapeMode == Tag::escape_mode::Unescape) {
-                    value = unescapeHtml(value);
-                }
-                output += value;
-                lastTagEnd = tag.end;
-                break;
+        if (auto floatValue = value->get_value_optional<float>(); floatValue.has_value()) {
+            std::ostringstream oss;
+            oss.precision(6);
+            oss << std::defaultfloat << *floatValue;
+            return oss.str();
+        }
+
+        if (auto strValue = value->get_value_optional<std::string>()) {
+            return *strValue;
+        }
+
+        return {};
+    }
+
+    void push(std::string_view key, int index = -1) override { pushResolved(resolve(key), index); }
+
+    void pop() override
+    {
+        if (!m_contextStack.empty()) {
+            m_contextStack.pop_back();
+        }
+    }
+
+    size_t listCount(std::string_view key) const override { return resolvedCount(resolve(key)); }
+
+    ResolvedKey resolve(std::string_view key) const override
+    {
+        ResolvedKey resolved{key};
+        resolved.value = lookup(key, resolved.frame);
+        return resolved;
+    }
+
+    size_t resolvedCount(const ResolvedKey &resolved) const override
+    {
+        const auto *value = static_cast<const boost::property_tree::ptree *>(resolved.value);
+        return value ? value->size() : 0;
+    }
+
+    bool resolvedFalse(const ResolvedKey &resolved) const override
+    {
+        return isFalseTree(static_cast<const boost::property_tree::ptree *>(resolved.value));
+    }
+
+    // Trees without children push an empty frame, list elements are reached from the previous one
+    void pushResolved(const ResolvedKey &resolved, int index = -1) override
+    {
+        const auto *value = static_cast<const boost::property_tree::ptree *>(resolved.value);
+        if (!value || value->empty()) {
+            m_contextStack.push_back(nullptr);
+            return;
+        }
+        if (index < 0) {
+            m_contextStack.push_back(value);
+            return;
+        }
+        if (static_cast<size_t>(index) >= value->size()) {
+            m_contextStack.push_back(nullptr);
+            return;
+        }
+
+        if (m_cursors.size() < m_contextStack.size()) {
+            m_cursors.resize(m_contextStack.size());
+        }
+        Cursor &cursor = m_cursors[m_contextStack.size() - 1];
+        if (cursor.list == value && cursor.index + 1 == index) {
+            ++cursor.element;
+        }
+        else {
+            cursor.element = std::next(value->begin(), index);
+        }
+        cursor.list = value;
+        cursor.index = index;
+        m_contextStack.push_back(&cursor.element->second);
+    }
+
+    std::optional<std::string> frameKey() const override
+    {
+        std::string key;
+        encodeTree(key, m_contextStack.back() ? *m_contextStack.back() : boost::property_tree::ptree());
+        return key;
+    }
+
+private:
+    // Last list element pushed at a depth, so that iterating a list does not walk it from the start each time
+    struct Cursor {
+        const boost::property_tree::ptree *list{nullptr};
+        int index{-1};
+        boost::property_tree::ptree::const_iterator element;
+    };
+
+    // Tree for key and the index of the frame it was found in, null and the innermost frame if it was not found
+    const boost::property_tree::ptree *lookup(std::string_view key, size_t &frame) const
+    {
+        frame = m_contextStack.size() - 1;
+        if (key == ".") {
+            countLookup(true);
+            return m_contextStack.back();
+        }
+
+        for (size_t i = m_contextStack.size(); i-- > 0;) {
+            if (!m_contextStack[i]) {
+                continue;
             }
+            if (const boost::property_tree::ptree *value = child(*m_contextStack[i], key)) {
+                countLookup(true);
+                frame = i;
+                return value;
+            }
+        }
+        countLookup(false);
+        return nullptr;
+    }
 
-            case Tag::type::SectionStart: {
-                Tag endTag = findEndTag(templ, tag, endPos);
-                if (endTag.type == Tag::type::Null) {
-                    if (!m_errorPos) {
-                        setError("No matching end tag found for section", tag.start);
-                    }
-                }
-                else {
-                    size_t listCount = context->listCount(tag.key);
-                    if (listCount > 0) {
-                        for (size_t i = 0; i < listCount; ++i) {
-                            context->push(tag.key, i);
-                            output += render(templ, tag.end, endTag.start, context);
-                            context->pop();
-                        }
-                    }
-                    else if (context->canEval(tag.key)) {
-                        output += context->eval(tag.key, templ.substr(tag.end, endTag.start - tag.end), this);
-                    }
-                    else if (!context->isFalse(tag.key)) {
-                        context->push(tag.key);
-                        output += render(templ, tag.end, endTag.start, context);
-                        context->pop();
+    // Trees with more children than this are searched through their key index, which takes a std::string
+    static constexpr size_t smallTree = 16;
+
+    // Child at key, split into a path at dots like ptree paths, null if it is missing
+    static const boost::property_tree::ptree *child(const boost::property_tree::ptree &tree, std::string_view key)
+    {
+        if (key.empty()) {
+            return &tree;
+        }
+        const boost::property_tree::ptree *node = &tree;
+        for (;;) {
+            const size_t dot = key.find('.');
+            const std::string_view name = key.substr(0, dot);
+            const boost::property_tree::ptree *next = nullptr;
+            if (node->size() <= smallTree) {
+                for (const auto &[childKey, childTree] : *node) {
+                    if (childKey == name) {
+                        next = &childTree;
+                        break;
                     }
-                    lastTagEnd = endTag.end;
                 }
-                break;
             }
-            case Tag::type::InvertedSectionStart: {
-                Tag endTag = findEndTag(templ, tag, endPos);
-                if (endTag.type == Tag::type::Null) {
-                    if (!m_errorPos) {
-                        setError("No matching end tag found for inverted section", tag.start);
-                    }
-                }
-                else {
-                    if (context->isFalse(tag.key)) {
-                        output += render(templ, tag.end, endTag.start, context);
-                    }
-                    lastTagEnd = endTag.end;
-                }
-                break;
+            else if (auto it = node->find(std::string(name)); it != node->not_found()) {
+                next = &it->second;
             }
+            if (!next) {
+                return nullptr;
+            }
+            node = next;
+            if (dot == std::string_view::npos) {
+                return node;
+            }
+            key.remove_prefix(dot + 1);
+        }
+    }
 
-            case Tag::type::Partial: {
-                std::string tagStartMarker = m_tagStartMarker;
-                std::string tagEndMarker = m_tagEndMarker;
-                m_tagStartMarker = m_defaultTagStartMarker;
-                m_tagEndMarker = m_defaultTagEndMarker;
-                m_partialStack.push_back(tag.key);
-
-                std::string partialContent = context->partialValue(tag.key);
-                if (tag.indentation > 0) {
-                    output += std::string(tag.indentation, ' ');
-                    size_t pos = 0;
-                    while ((pos = partialContent.find('\n', pos)) != std::string::npos) {
-                        if (pos < partialContent.length() - 1) {
-                            partialContent.insert(pos + 1, std::string(tag.indentation, ' '));
-                        }
-                        pos += tag.indentation + 1;
-                    }
-                }
+    static bool isFalseTree(const boost::property_tree::ptree *value)
+    {
+        if (!value) {
+            return true;
+        }
+        const std::string &data = value->data();
+        // Empty data is false either way, skip the translator
+        if (data.empty()) {
+            return true;
+        }
+        if (auto boolValue = value->get_value_optional<bool>()) {
+            return !*boolValue;
+        }
+        return isFalseString(data);
+    }
+
+    // Length prefixed data, then the children in order, so that distinct trees never share an encoding
+    static void encodeTree(std::string &out, const boost::property_tree::ptree &tree)
+    {
+        encodeString(out, tree.data());
+        encodeSize(out, tree.size());
+        for (const auto &[key, child] : tree) {
+            encodeString(out, key);
+            encodeTree(out, child);
+        }
+    }
+
+    std::unique_ptr<boost::property_tree::ptree> m_root; // frames point into it, so it stays put when moved
+    std::vector<const boost::property_tree::ptree *> m_contextStack; // null for missing data
+    std::vector<Cursor> m_cursors;
+};
+
+// File-based partial resolver
+class PartialFileLoader : public PartialResolver {
+public:
+    explicit PartialFileLoader(std::string_view basePath) : m_basePath(basePath) {}
+
+    std::string getPartial(std::string_view name) override
+    {
+        std::string nameStr{name};
+        if (m_cache.count(nameStr)) {
+            return m_cache[nameStr];
+        }
+
+        auto path = std::filesystem::path(m_basePath) / (std::string(name) + ".mustache");
+        std::ifstream file(path);
+        if (file) {
+            std::stringstream buffer;
+            buffer << file.rdbuf();
+            auto content = buffer.str();
+            m_cache[nameStr] = content;
+            return content;
+        }
+        return {};
+    }
+
+private:
+    std::string m_basePath;
+    std::unordered_map<std::string, std::string> m_cache;
+};
+
+// Tag structure
+struct Tag {
+    enum class type { Null, Value, SectionStart, InvertedSectionStart, SectionEnd, Partial, Comment, SetDelimiter };
+
+    enum class escape_mode { Escape, Unescape, Raw };
+
+    type type{type::Null};
+    std::string key;
+    size_t hash{0}; // keyHash(key)
+    size_t start{0};
+    size_t end{0};
+    escape_mode escapeMode{escape_mode::Escape};
+    size_t indentation{0};
+};
+
+// Profiling sample reported once per rendered tag
+struct TagProfile {
+    std::string_view templateName; // partial name, empty for the root template
+    std::string_view key;
+    enum Tag::type type{Tag::type::Null};
+    size_t position{0};            // tag offset inside its template
+    std::string_view stack;        // enclosing tags, ';'-separated (flamegraph folded format)
+    std::chrono::nanoseconds elapsed{0}; // including nested tags
+    std::chrono::nanoseconds self{0};    // excluding nested tags
+    size_t iterations{0};          // section bodies rendered
+    size_t bytes{0};               // bytes emitted, including nested tags
+    size_t depth{0};               // context frames visible to lookups of this tag
+};
+
+// Profiler interface, only consulted when BOOST_MUSTACHE_PROFILING is defined.
+// String views inside the sample are valid for the duration of the call only.
+class RenderProfiler {
+public:
+    virtual ~RenderProfiler() = default;
+    virtual void tagRendered(const TagProfile &sample) = 0;
+};
+
+// Profiler aggregating samples per template and tag position
+class RenderProfile : public RenderProfiler {
+public:
+    struct Entry {
+        std::string templateName;
+        std::string key;
+        enum Tag::type type{Tag::type::Null};
+        size_t position{0};
+        size_t calls{0}; // for partial tags this is the expansion count
+        size_t iterations{0};
+        size_t bytes{0};
+        size_t maxDepth{0};
+        std::chrono::nanoseconds elapsed{0};
+        std::chrono::nanoseconds self{0};
+    };
+
+    void tagRendered(const TagProfile &sample) override
+    {
+        auto &entry = m_entries[{std::string(sample.templateName), sample.position}];
+        if (entry.calls == 0) {
+            entry.templateName = std::string(sample.templateName);
+            entry.key = std::string(sample.key);
+            entry.type = sample.type;
+            entry.position = sample.position;
+        }
+        ++entry.calls;
+        entry.iterations += sample.iterations;
+        entry.bytes += sample.bytes;
+        entry.maxDepth = std::max(entry.maxDepth, sample.depth);
+        entry.elapsed += sample.elapsed;
+        entry.self += sample.self;
+        m_stacks[std::string(sample.stack)] += sample.self;
+    }
+
+    std::vector<Entry> entries() const
+    {
+        std::vector<Entry> result;
+        result.reserve(m_entries.size());
+        for (const auto &entry : m_entries | boost::adaptors::map_values) {
+            result.push_back(entry);
+        }
+        return result;
+    }
+
+    // Self time per tag stack, one "stack nanoseconds" line each, as consumed by flamegraph tools
+    std::string foldedStacks() const
+    {
+        std::string result;
+        for (const auto &[stack, self] : m_stacks) {
+            result += stack;
+            result += ' ';
+            result += std::to_string(self.count());
+            result += '\n';
+        }
+        return result;
+    }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_stacks.clear();
+    }
+
+private:
+    std::map<std::pair<std::string, size_t>, Entry> m_entries;
+    std::map<std::string, std::chrono::nanoseconds> m_stacks;
+};
 
-                output += render(partialContent, 0, partialContent.length(), context);
-                lastTagEnd = tag.end;
-                m_partialStack.pop_back();
-                m_tagStartMarker = tagStartMarker;
-                m_tagEndMarker = tagEndMarker;
+// Node of a compiled template: literal text or a tag with its section body
+struct Node {
+    Tag tag;         // Tag::type::Null for literal text
+    size_t start{0}; // literal text, or the raw section body handed to lambdas
+    size_t end{0};
+    std::vector<Node> children;
+    FunctionSlot function; // sections only
+};
+
+// Compiles template text into a tree of nodes
+class TemplateParser {
+public:
+    TemplateParser(std::string_view content, std::string_view startMarker, std::string_view endMarker)
+        : m_content(content), m_tagStartMarker(startMarker), m_tagEndMarker(endMarker)
+    {
+    }
+
+    std::string_view error() const { return m_error; }
+    std::optional<size_t> errorPos() const { return m_errorPos; }
+
+    std::vector<Node> parse()
+    {
+        std::vector<Node> nodes;
+        std::vector<Node> sections; // open sections, innermost last
+        size_t pos = 0;
+
+        while (!m_errorPos) {
+            auto &target = sections.empty() ? nodes : sections.back().children;
+            Tag tag = findTag(m_content, pos, m_content.length());
+            if (tag.type == Tag::type::Null) {
+                addText(target, pos, m_content.length());
                 break;
             }
 
-            case Tag::type::SetDelimiter:
-                lastTagEnd = tag.end;
+            addText(target, pos, tag.start);
+            pos = tag.end;
+
+            switch (tag.type) {
+            case Tag::type::Value:
+            case Tag::type::Partial: {
+                Node node;
+                node.tag = std::move(tag);
+                target.push_back(std::move(node));
                 break;
+            }
 
-            case Tag::type::Comment:
-                lastTagEnd = tag.end;
+            case Tag::type::SectionStart:
+            case Tag::type::InvertedSectionStart: {
+                Node node;
+                node.start = tag.end;
+                node.tag = std::move(tag);
+                if (node.tag.type == Tag::type::SectionStart) {
+                    node.function = FunctionRegistry::instance().resolve(node.tag.key);
+                }
+                sections.push_back(std::move(node));
                 break;
+            }
 
-            case Tag::type::SectionEnd:
-                setError("Unexpected end tag", tag.start);
-                lastTagEnd = tag.end;
+            case Tag::type::SectionEnd: {
+                if (sections.empty()) {
+                    setError("Unexpected end tag", tag.start);
+                    break;
+                }
+                if (sections.back().tag.key != tag.key) {
+                    setError("Tag start/end key mismatch", tag.start);
+                    break;
+                }
+                Node node = std::move(sections.back());
+                sections.pop_back();
+                node.end = tag.start;
+                (sections.empty() ? nodes : sections.back().children).push_back(std::move(node));
                 break;
+            }
 
+            case Tag::type::Comment:
+            case Tag::type::SetDelimiter:
             case Tag::type::Null:
                 break;
             }
         }
-        return output;
+
+        if (!m_errorPos && !sections.empty()) {
+            const Tag &tag = sections.front().tag;
+            setError(tag.type == Tag::type::SectionStart ? "No matching end tag found for section"
+                                                         : "No matching end tag found for inverted section",
+                    tag.start);
+        }
+        return nodes;
+    }
+
+private:
+    static void addText(std::vector<Node> &nodes, size_t start, size_t end)
+    {
+        if (start >= end) {
+            return;
+        }
+        Node node;
+        node.start = start;
+        node.end = end;
+        nodes.push_back(std::move(node));
     }
 
     Tag findTag(std::string_view content, size_t pos, size_t endPos)
@@ -513,44 +1136,15 @@ private:
         if (tag.type != Tag::type::Value) {
             expandTag(tag, content);
         }
+        tag.hash = keyHash(tag.key);
 
         return tag;
     }
 
-    Tag findEndTag(std::string_view content, const Tag &startTag, size_t endPos)
-    {
-        int tagDepth = 1;
-        size_t pos = startTag.end;
-
-        while (true) {
-            Tag nextTag = findTag(content, pos, endPos);
-            if (nextTag.type == Tag::type::Null) {
-                return nextTag;
-            }
-            else if (nextTag.type == Tag::type::SectionStart || nextTag.type == Tag::type::InvertedSectionStart) {
-                ++tagDepth;
-            }
-            else if (nextTag.type == Tag::type::SectionEnd) {
-                --tagDepth;
-                if (tagDepth == 0) {
-                    if (nextTag.key != startTag.key) {
-                        setError("Tag start/end key mismatch", nextTag.start);
-                        return Tag{};
-                    }
-                    return nextTag;
-                }
-            }
-            pos = nextTag.end;
-        }
-    }
-
     void setError(std::string_view error, size_t pos)
     {
         m_error = std::string(error);
         m_errorPos = pos;
-        if (!m_partialStack.empty()) {
-            m_errorPartial = m_partialStack.back();
-        }
     }
 
     void readSetDelimiter(std::string_view content, size_t pos, size_t endPos)
@@ -630,159 +1224,2484 @@ private:
     }
 
 private:
-    std::vector<std::string> m_partialStack;
-    std::string m_error;
-    std::optional<size_t> m_errorPos;
-    std::string m_errorPartial;
+    std::string_view m_content;
     std::string m_tagStartMarker;
     std::string m_tagEndMarker;
-    std::string m_defaultTagStartMarker;
-    std::string m_defaultTagEndMarker;
+    std::string m_error;
+    std::optional<size_t> m_errorPos;
 };
 
-// Add new JsonContext class
-class JsonContext : public Context {
+// Running estimate of a template's output size, exponentially smoothed over past renders
+class SizeEstimate {
 public:
-    explicit JsonContext(const boost::json::value &root, std::shared_ptr<PartialResolver> resolver = nullptr)
-        : Context(std::move(resolver))
+    SizeEstimate() = default;
+    SizeEstimate(const SizeEstimate &other) : m_value(other.value()) {}
+
+    SizeEstimate &operator=(const SizeEstimate &other)
     {
-        m_contextStack.push_back(root);
+        m_value.store(other.value(), std::memory_order_relaxed);
+        return *this;
     }
 
-    boost::json::value getValue(std::string_view key) const
+    size_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+    void update(size_t size)
+    {
+        size_t current = value();
+        size_t next;
+        do {
+            next = current == 0 ? size : current - current / 4 + size / 4;
+        } while (!m_value.compare_exchange_weak(current, next, std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<size_t> m_value{0};
+};
+
+// Compiled template. Immutable once built apart from its size estimate, so it can be shared between threads.
+class Template {
+public:
+    explicit Template(std::string source, std::string_view startMarker = "{{", std::string_view endMarker = "}}")
+        : m_source(std::move(source))
+    {
+        TemplateParser parser(m_source, startMarker, endMarker);
+        m_nodes = parser.parse();
+        m_error = std::string(parser.error());
+        m_errorPos = parser.errorPos();
+    }
+
+    // Identifies the compiled template in caches shared between renders, copies share it
+    uint64_t id() const { return m_id; }
+
+    bool valid() const { return !m_errorPos; }
+    std::string_view error() const { return m_error; }
+    std::optional<size_t> errorPos() const { return m_errorPos; }
+
+    const std::string &source() const { return m_source; }
+    const std::vector<Node> &nodes() const { return m_nodes; }
+
+    // Literal text of a text node, raw body of a section node
+    std::string_view text(const Node &node) const
     {
+        return std::string_view(m_source).substr(node.start, node.end - node.start);
+    }
+
+    size_t sizeEstimate() const { return m_sizeEstimate.value(); }
+    void recordOutputSize(size_t size) const { m_sizeEstimate.update(size); }
+
+    // Attaches functions to this template and its partials, layered over the global registry.
+    // Must be called before the template is shared between threads.
+    void setFunctions(std::shared_ptr<const FunctionSet> functions)
+    {
+        m_functions = std::move(functions);
+        m_id = nextId();
+        resolveFunctions(m_nodes);
+    }
+
+    std::shared_ptr<const FunctionSet> functions() const { return m_functions; }
+
+private:
+    static uint64_t nextId()
+    {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    void resolveFunctions(std::vector<Node> &nodes)
+    {
+        for (auto &node : nodes) {
+            if (node.tag.type != Tag::type::SectionStart && node.tag.type != Tag::type::InvertedSectionStart) {
+                continue;
+            }
+            if (node.tag.type == Tag::type::SectionStart) {
+                const Function *function = m_functions ? m_functions->find(node.tag.key) : nullptr;
+                node.function = function ? FunctionSlot{function, 0, true} : FunctionRegistry::instance().resolve(node.tag.key);
+            }
+            resolveFunctions(node.children);
+        }
+    }
+
+    std::string m_source;
+    std::vector<Node> m_nodes;
+    std::shared_ptr<const FunctionSet> m_functions;
+    uint64_t m_id{nextId()};
+    std::string m_error;
+    std::optional<size_t> m_errorPos;
+    mutable SizeEstimate m_sizeEstimate;
+};
+
+// How a template uses a section key
+struct SectionUsage {
+    bool section{false};  // rendered as a list, object or truthy value
+    bool inverted{false}; // only tested for falsiness
+    bool items{false};    // the body renders the current item with {{.}}, as lists of scalars do
+};
+
+// Data a template needs, with paths joined by dots relative to the enclosing sections. As a key missing
+// from a section's data resolves in the enclosing ones, a path may also be satisfied by a shorter one.
+struct TemplateAnalysis {
+    std::set<std::string> keys;
+    std::map<std::string, SectionUsage> sections;
+    std::set<std::string> partials;
+    std::set<std::string> functions; // section keys rendered by registered or template functions
+    std::set<std::string> invalidPartials;
+};
+
+// Walks compiled nodes and, when a resolver is given, the partials they include
+inline TemplateAnalysis analyze(const Node *first, const Node *last, PartialResolver *resolver = nullptr)
+{
+    TemplateAnalysis analysis;
+    std::vector<std::string> partialStack;
+
+    auto joinPath = [](const std::string &scope, const std::string &key) {
         if (key == ".") {
-            return m_contextStack.back();
+            return scope.empty() ? key : scope;
         }
+        return scope.empty() ? key : scope + '.' + key;
+    };
+
+    std::function<void(const Node *, const Node *, const std::string &)> walk;
+    auto walkNodes = [&walk](const std::vector<Node> &nodes, const std::string &scope) {
+        walk(nodes.data(), nodes.data() + nodes.size(), scope);
+    };
+    walk = [&](const Node *begin, const Node *end, const std::string &scope) {
+        for (const Node *it = begin; it != end; ++it) {
+            const Node &node = *it;
+            const Tag &tag = node.tag;
+            switch (tag.type) {
+            case Tag::type::Value:
+                analysis.keys.insert(joinPath(scope, tag.key));
+                if (tag.key == "." && !scope.empty()) {
+                    analysis.sections[scope].items = true;
+                }
+                break;
+
+            case Tag::type::SectionStart:
+                if (FunctionRegistry::instance().find(tag.key, &node.function)) {
+                    analysis.functions.insert(tag.key);
+                    walkNodes(node.children, scope);
+                }
+                else {
+                    const std::string path = joinPath(scope, tag.key);
+                    analysis.sections[path].section = true;
+                    walkNodes(node.children, path);
+                }
+                break;
 
-        std::string keyStr{key};
+            case Tag::type::InvertedSectionStart:
+                analysis.sections[joinPath(scope, tag.key)].inverted = true;
+                walkNodes(node.children, scope);
+                break;
 
-        for (const auto &ctx : boost::adaptors::reverse(m_contextStack)) {
-            if (ctx.is_object()) {
-                const auto &obj = ctx.as_object();
-                if (auto it = obj.find(keyStr); it != obj.end()) {
-                    return it->value();
+            case Tag::type::Partial: {
+                analysis.partials.insert(tag.key);
+                if (!resolver || std::find(partialStack.begin(), partialStack.end(), tag.key) != partialStack.end()) {
+                    break;
+                }
+                const Template partial(resolver->getPartial(tag.key));
+                if (!partial.valid()) {
+                    analysis.invalidPartials.insert(tag.key);
+                    break;
                 }
+                partialStack.push_back(tag.key);
+                walkNodes(partial.nodes(), scope);
+                partialStack.pop_back();
+                break;
+            }
+
+            default:
+                break;
             }
         }
-        return {};
-    }
+    };
 
-    bool isFalse(std::string_view key) const override
-    {
-        auto value = getValue(key);
+    walk(first, last, {});
+    return analysis;
+}
+
+inline TemplateAnalysis analyze(const Template &templ, PartialResolver *resolver = nullptr)
+{
+    const auto &nodes = templ.nodes();
+    return analyze(nodes.data(), nodes.data() + nodes.size(), resolver);
+}
+
+// Destination of rendered output
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    // Text only valid for the duration of the call
+    virtual void write(std::string_view text) = 0;
+
+    // Literal template text, valid for as long as the compiled template it comes from
+    virtual void writeLiteral(std::string_view text) { write(text); }
+
+    // Returns true if the sink keeps the template alive, allowing literal references into it
+    virtual bool retain(const std::shared_ptr<const Template> &) { return false; }
+
+    virtual void reserve(size_t) {}
+
+    // Lets a RenderStream suspend rendering, ignored by Renderer::render()
+    virtual bool full() const { return false; }
+};
 
-        if (value.is_bool()) {
-            return !value.as_bool();
+// Sink appending to a string
+class StringSink : public OutputSink {
+public:
+    explicit StringSink(std::string &output) : m_output(output) {}
+
+    void write(std::string_view text) override
+    {
+        const size_t capacity = m_output.capacity();
+        m_output.append(text);
+        if (m_output.capacity() != capacity) {
+            ++m_allocations;
         }
+    }
 
-        if (value.is_string()) {
-            std::string str = value.as_string().c_str();
-            std::string lowerStr = str;
-            boost::range::transform(lowerStr, lowerStr.begin(), ::tolower);
-            return lowerStr == "false" || str.empty();
+    void reserve(size_t size) override
+    {
+        const size_t capacity = m_output.capacity();
+        m_output.reserve(size);
+        if (m_output.capacity() != capacity) {
+            ++m_allocations;
         }
+    }
 
-        if (value.is_null()) {
-            return true;
+    // Buffer allocations made while writing
+    size_t allocations() const { return m_allocations; }
+
+private:
+    std::string &m_output;
+    size_t m_allocations{0};
+};
+
+// Scatter-gather sink for writev(). Literal template text is referenced in place, only dynamic
+// values are copied into sink-owned blocks. Segments stay valid until clear() or destruction,
+// provided the rendered compiled template outlives them.
+class IoVecSink : public OutputSink {
+public:
+    explicit IoVecSink(size_t blockSize = 4096) : m_blockSize(blockSize) {}
+
+    void write(std::string_view text) override
+    {
+        if (text.empty()) {
+            return;
+        }
+        if (m_blocks.empty() || m_blockUsed + text.size() > m_blockCapacity) {
+            m_blockCapacity = std::max(m_blockSize, text.size());
+            m_blocks.push_back(std::make_unique<char[]>(m_blockCapacity));
+            m_blockUsed = 0;
         }
+        char *data = m_blocks.back().get() + m_blockUsed;
+        std::memcpy(data, text.data(), text.size());
+        m_blockUsed += text.size();
+        addSegment({data, text.size()});
+    }
 
-        return false;
+    void writeLiteral(std::string_view text) override
+    {
+        if (!text.empty()) {
+            addSegment(text);
+        }
     }
 
-    std::string stringValue(std::string_view key) const override
+    bool retain(const std::shared_ptr<const Template> &templ) override
     {
-        auto value = getValue(key);
+        if (std::find(m_retained.begin(), m_retained.end(), templ) == m_retained.end()) {
+            m_retained.push_back(templ);
+        }
+        return true;
+    }
 
-        if (value.is_double()) {
-            std::ostringstream oss;
-            oss.precision(6);
+    const std::vector<std::string_view> &segments() const { return m_segments; }
+    size_t size() const { return m_size; }
 
-            if (const auto dvalue = value.as_double(); std::floor(dvalue) == dvalue) {
-                oss << std::fixed << std::setprecision(0) << dvalue;
-            }
-            else {
-                oss << std::defaultfloat << dvalue;
-            }
-            return oss.str();
+    std::string str() const
+    {
+        std::string result;
+        result.reserve(m_size);
+        for (const auto &segment : m_segments) {
+            result.append(segment);
         }
+        return result;
+    }
 
-        if (value.is_string()) {
-            return std::string(value.as_string());
+#if __has_include(<sys/uio.h>)
+    // Segments as iovecs; writev() accepts at most IOV_MAX of them per call
+    std::vector<iovec> iovecs() const
+    {
+        std::vector<iovec> result;
+        result.reserve(m_segments.size());
+        for (const auto &segment : m_segments) {
+            result.push_back({const_cast<char *>(segment.data()), segment.size()});
         }
+        return result;
+    }
+#endif
 
-        if (value.is_bool()) {
-            return value.as_bool() ? "true" : "false";
-        }
+    void clear()
+    {
+        m_segments.clear();
+        m_blocks.clear();
+        m_retained.clear();
+        m_blockUsed = 0;
+        m_blockCapacity = 0;
+        m_size = 0;
+    }
 
-        if (value.is_number()) {
-            return std::to_string(value.as_int64());
+private:
+    void addSegment(std::string_view text)
+    {
+        m_size += text.size();
+        if (!m_segments.empty() && m_segments.back().data() + m_segments.back().size() == text.data()) {
+            m_segments.back() = std::string_view(m_segments.back().data(), m_segments.back().size() + text.size());
+            return;
         }
+        m_segments.push_back(text);
+    }
 
-        return {};
+    size_t m_blockSize;
+    size_t m_blockUsed{0};
+    size_t m_blockCapacity{0};
+    size_t m_size{0};
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    std::vector<std::string_view> m_segments;
+    std::vector<std::shared_ptr<const Template>> m_retained;
+};
+
+// Compiled section handed to a SectionFunction, valid for the duration of the call
+class Section {
+public:
+    std::string_view key() const { return m_node->tag.key; }
+    std::string_view text() const { return m_templ->text(*m_node); }
+    Renderer *renderer() const { return m_renderer; }
+    Context *context() const { return m_context; }
+
+    // Renders the body against the current context, as many times as needed
+    void render(OutputSink &sink) const;
+    std::string render() const;
+
+private:
+    friend class Renderer;
+
+    Section(Renderer *renderer, Context *context, const Template *templ, const Node *node, const OutputSink *sink, bool stable)
+        : m_renderer(renderer), m_context(context), m_templ(templ), m_node(node), m_sink(sink), m_stable(stable)
+    {
+    }
+
+    Renderer *m_renderer;
+    Context *m_context;
+    const Template *m_templ;
+    const Node *m_node;
+    const OutputSink *m_sink; // the render's own sink, which literal text may reference
+    bool m_stable;
+};
+
+// Counters collected by Renderer::render(), including nested lambda renders
+struct RenderStats {
+    size_t tags{0};         // tags processed
+    size_t lookups{0};      // context key lookups
+    size_t lookupMisses{0}; // lookups not found in any context frame
+    size_t escapes{0};      // values passed through HTML escaping
+    size_t bytesEscaped{0}; // value bytes passed through HTML escaping
+    size_t bytesCopied{0};  // template text and unescaped value bytes written to the output
+    size_t allocations{0};  // heap allocations of renderer-owned strings and string sinks
+    size_t functionCacheHits{0};
+    size_t sectionCacheHits{0};
+    size_t outputSize{0};
+};
+
+#ifdef BOOST_MUSTACHE_FULL_ENTITIES
+// Code point of an HTML 4 named character reference or &apos;, zero if there is none
+inline char32_t namedEntity(std::string_view name)
+{
+    static constexpr std::pair<std::string_view, char32_t> entities[] = {
+        {"AElig", 0xC6}, {"Aacute", 0xC1}, {"Acirc", 0xC2}, {"Agrave", 0xC0}, {"Alpha", 0x391}, {"Aring", 0xC5},
+        {"Atilde", 0xC3}, {"Auml", 0xC4}, {"Beta", 0x392}, {"Ccedil", 0xC7}, {"Chi", 0x3A7}, {"Dagger", 0x2021},
+        {"Delta", 0x394}, {"ETH", 0xD0}, {"Eacute", 0xC9}, {"Ecirc", 0xCA}, {"Egrave", 0xC8}, {"Epsilon", 0x395},
+        {"Eta", 0x397}, {"Euml", 0xCB}, {"Gamma", 0x393}, {"Iacute", 0xCD}, {"Icirc", 0xCE}, {"Igrave", 0xCC},
+        {"Iota", 0x399}, {"Iuml", 0xCF}, {"Kappa", 0x39A}, {"Lambda", 0x39B}, {"Mu", 0x39C}, {"Ntilde", 0xD1},
+        {"Nu", 0x39D}, {"OElig", 0x152}, {"Oacute", 0xD3}, {"Ocirc", 0xD4}, {"Ograve", 0xD2}, {"Omega", 0x3A9},
+        {"Omicron", 0x39F}, {"Oslash", 0xD8}, {"Otilde", 0xD5}, {"Ouml", 0xD6}, {"Phi", 0x3A6}, {"Pi", 0x3A0},
+        {"Prime", 0x2033}, {"Psi", 0x3A8}, {"Rho", 0x3A1}, {"Scaron", 0x160}, {"Sigma", 0x3A3}, {"THORN", 0xDE},
+        {"Tau", 0x3A4}, {"Theta", 0x398}, {"Uacute", 0xDA}, {"Ucirc", 0xDB}, {"Ugrave", 0xD9}, {"Upsilon", 0x3A5},
+        {"Uuml", 0xDC}, {"Xi", 0x39E}, {"Yacute", 0xDD}, {"Yuml", 0x178}, {"Zeta", 0x396}, {"aacute", 0xE1},
+        {"acirc", 0xE2}, {"acute", 0xB4}, {"aelig", 0xE6}, {"agrave", 0xE0}, {"alefsym", 0x2135}, {"alpha", 0x3B1},
+        {"amp", 0x26}, {"and", 0x2227}, {"ang", 0x2220}, {"apos", 0x27}, {"aring", 0xE5}, {"asymp", 0x2248},
+        {"atilde", 0xE3}, {"auml", 0xE4}, {"bdquo", 0x201E}, {"beta", 0x3B2}, {"brvbar", 0xA6}, {"bull", 0x2022},
+        {"cap", 0x2229}, {"ccedil", 0xE7}, {"cedil", 0xB8}, {"cent", 0xA2}, {"chi", 0x3C7}, {"circ", 0x2C6},
+        {"clubs", 0x2663}, {"cong", 0x2245}, {"copy", 0xA9}, {"crarr", 0x21B5}, {"cup", 0x222A}, {"curren", 0xA4},
+        {"dArr", 0x21D3}, {"dagger", 0x2020}, {"darr", 0x2193}, {"deg", 0xB0}, {"delta", 0x3B4}, {"diams", 0x2666},
+        {"divide", 0xF7}, {"eacute", 0xE9}, {"ecirc", 0xEA}, {"egrave", 0xE8}, {"empty", 0x2205}, {"emsp", 0x2003},
+        {"ensp", 0x2002}, {"epsilon", 0x3B5}, {"equiv", 0x2261}, {"eta", 0x3B7}, {"eth", 0xF0}, {"euml", 0xEB},
+        {"euro", 0x20AC}, {"exist", 0x2203}, {"fnof", 0x192}, {"forall", 0x2200}, {"frac12", 0xBD}, {"frac14", 0xBC},
+        {"frac34", 0xBE}, {"frasl", 0x2044}, {"gamma", 0x3B3}, {"ge", 0x2265}, {"gt", 0x3E}, {"hArr", 0x21D4},
+        {"harr", 0x2194}, {"hearts", 0x2665}, {"hellip", 0x2026}, {"iacute", 0xED}, {"icirc", 0xEE}, {"iexcl", 0xA1},
+        {"igrave", 0xEC}, {"image", 0x2111}, {"infin", 0x221E}, {"int", 0x222B}, {"iota", 0x3B9}, {"iquest", 0xBF},
+        {"isin", 0x2208}, {"iuml", 0xEF}, {"kappa", 0x3BA}, {"lArr", 0x21D0}, {"lambda", 0x3BB}, {"lang", 0x2329},
+        {"laquo", 0xAB}, {"larr", 0x2190}, {"lceil", 0x2308}, {"ldquo", 0x201C}, {"le", 0x2264}, {"lfloor", 0x230A},
+        {"lowast", 0x2217}, {"loz", 0x25CA}, {"lrm", 0x200E}, {"lsaquo", 0x2039}, {"lsquo", 0x2018}, {"lt", 0x3C},
+        {"macr", 0xAF}, {"mdash", 0x2014}, {"micro", 0xB5}, {"middot", 0xB7}, {"minus", 0x2212}, {"mu", 0x3BC},
+        {"nabla", 0x2207}, {"nbsp", 0xA0}, {"ndash", 0x2013}, {"ne", 0x2260}, {"ni", 0x220B}, {"not", 0xAC},
+        {"notin", 0x2209}, {"nsub", 0x2284}, {"ntilde", 0xF1}, {"nu", 0x3BD}, {"oacute", 0xF3}, {"ocirc", 0xF4},
+        {"oelig", 0x153}, {"ograve", 0xF2}, {"oline", 0x203E}, {"omega", 0x3C9}, {"omicron", 0x3BF}, {"oplus", 0x2295},
+        {"or", 0x2228}, {"ordf", 0xAA}, {"ordm", 0xBA}, {"oslash", 0xF8}, {"otilde", 0xF5}, {"otimes", 0x2297},
+        {"ouml", 0xF6}, {"para", 0xB6}, {"part", 0x2202}, {"permil", 0x2030}, {"perp", 0x22A5}, {"phi", 0x3C6},
+        {"pi", 0x3C0}, {"piv", 0x3D6}, {"plusmn", 0xB1}, {"pound", 0xA3}, {"prime", 0x2032}, {"prod", 0x220F},
+        {"prop", 0x221D}, {"psi", 0x3C8}, {"quot", 0x22}, {"rArr", 0x21D2}, {"radic", 0x221A}, {"rang", 0x232A},
+        {"raquo", 0xBB}, {"rarr", 0x2192}, {"rceil", 0x2309}, {"rdquo", 0x201D}, {"real", 0x211C}, {"reg", 0xAE},
+        {"rfloor", 0x230B}, {"rho", 0x3C1}, {"rlm", 0x200F}, {"rsaquo", 0x203A}, {"rsquo", 0x2019}, {"sbquo", 0x201A},
+        {"scaron", 0x161}, {"sdot", 0x22C5}, {"sect", 0xA7}, {"shy", 0xAD}, {"sigma", 0x3C3}, {"sigmaf", 0x3C2},
+        {"sim", 0x223C}, {"spades", 0x2660}, {"sub", 0x2282}, {"sube", 0x2286}, {"sum", 0x2211}, {"sup", 0x2283},
+        {"sup1", 0xB9}, {"sup2", 0xB2}, {"sup3", 0xB3}, {"supe", 0x2287}, {"szlig", 0xDF}, {"tau", 0x3C4},
+        {"there4", 0x2234}, {"theta", 0x3B8}, {"thetasym", 0x3D1}, {"thinsp", 0x2009}, {"thorn", 0xFE},
+        {"tilde", 0x2DC}, {"times", 0xD7}, {"trade", 0x2122}, {"uArr", 0x21D1}, {"uacute", 0xFA}, {"uarr", 0x2191},
+        {"ucirc", 0xFB}, {"ugrave", 0xF9}, {"uml", 0xA8}, {"upsih", 0x3D2}, {"upsilon", 0x3C5}, {"uuml", 0xFC},
+        {"weierp", 0x2118}, {"xi", 0x3BE}, {"yacute", 0xFD}, {"yen", 0xA5}, {"yuml", 0xFF}, {"zeta", 0x3B6},
+        {"zwj", 0x200D}, {"zwnj", 0x200C}
+    };
+    auto it = std::lower_bound(std::begin(entities), std::end(entities), name,
+            [](const auto &entity, std::string_view key) { return entity.first < key; });
+    return it != std::end(entities) && it->first == name ? it->second : 0;
+}
+#endif
+
+class Renderer {
+public:
+    Renderer() : m_errorPos(std::nullopt), m_defaultTagStartMarker("{{"), m_defaultTagEndMarker("}}") {}
+
+    std::string_view error() const { return m_error; }
+    std::optional<size_t> errorPos() const { return m_errorPos; }
+    std::string_view errorPartial() const { return m_errorPartial; }
+    const RenderStats &stats() const { return m_stats; }
+
+    void setTagMarkers(std::string_view startMarker, std::string_view endMarker)
+    {
+        m_defaultTagStartMarker = std::string(startMarker);
+        m_defaultTagEndMarker = std::string(endMarker);
+    }
+
+    // Memoizes pure functions across renders. Without it, results are only reused within a render.
+    void setFunctionCache(std::shared_ptr<FunctionCache> cache) { m_functionCache = std::move(cache); }
+    std::shared_ptr<FunctionCache> functionCache() const { return m_functionCache; }
+
+    // Reuses the output of the sections the cache memoizes when they render the same data again
+    void setSectionCache(std::shared_ptr<SectionCache> cache)
+    {
+        if (cache) {
+            cache->m_attached.store(true, std::memory_order_release);
+        }
+        m_sectionCache = std::move(cache);
     }
+    std::shared_ptr<SectionCache> sectionCache() const { return m_sectionCache; }
 
-    size_t listCount(std::string_view key) const override
+#ifdef BOOST_MUSTACHE_PROFILING
+    void setProfiler(std::shared_ptr<RenderProfiler> profiler) { m_profiler = std::move(profiler); }
+    std::shared_ptr<RenderProfiler> profiler() const { return m_profiler; }
+#endif
+
+    Template compile(std::string templ) const
     {
-        auto value = getValue(key);
-        return value.is_array() ? value.as_array().size() : 0;
+        return Template(std::move(templ), m_defaultTagStartMarker, m_defaultTagEndMarker);
     }
 
-    void push(std::string_view key, int index = -1) override
+    std::string render(const std::string_view templ, Context *context) { return render(compile(std::string(templ)), context); }
+
+    // The output buffer is reserved up front from sizeHint or the template's running size estimate
+    std::string render(const Template &templ, Context *context, size_t sizeHint = 0)
     {
-        auto value = getValue(key);
+        std::string output;
+        StringSink sink(output);
+        render(templ, context, sink, sizeHint);
+        m_stats.allocations += sink.allocations();
+        return output;
+    }
 
-        if (value.is_null()) {
-            m_contextStack.emplace_back();
+    // Literal text is handed to the sink by reference, the template must outlive what the sink keeps of it
+    void render(const Template &templ, Context *context, OutputSink &sink, size_t sizeHint = 0)
+    {
+        State state;
+        if (!begin(state, templ, context, sink, sizeHint)) {
             return;
         }
+        run(state, context, sink, false);
+        finish(state, context);
+    }
 
-        if (index >= 0 && value.is_array()) {
-            const auto &arr = value.as_array();
-            if (static_cast<size_t>(index) < arr.size()) {
-                m_contextStack.push_back(arr[index]);
-            }
-            else {
-                m_contextStack.emplace_back();
+private:
+    friend class RenderStream;
+    friend class Section;
+    friend class IncrementalRenderer;
+    friend class JsonStreamRenderer;
+
+    struct PartialEntry {
+        std::string content;
+        std::shared_ptr<const Template> templ;
+    };
+
+    // Notified of every section the render reaches, nested ones and those in partials included, but not of
+    // sections that functions render. See IncrementalRenderer.
+    class SectionObserver {
+    public:
+        virtual ~SectionObserver() = default;
+        // Called before the section's key is looked up. Returning output skips the section and writes it instead.
+        virtual std::optional<std::string_view> enterSection(const Template &templ, const Node &node) = 0;
+        // Called when a section that was not skipped is done
+        virtual void leaveSection() = 0;
+    };
+
+    // Render progress kept on an explicit stack rather than native recursion, so that a render can be suspended
+    struct Frame {
+        const Template *templ{nullptr};
+        std::shared_ptr<const Template> partial; // keeps a compiled partial alive while it renders
+        const std::vector<Node> *nodes{nullptr};
+        size_t index{0};
+        size_t end{0};             // index past the last node to render
+        const Node *node{nullptr}; // section or partial whose body this frame renders, null for the root
+        size_t iteration{0};
+        size_t count{1};            // times the body renders
+        bool pushed{false};         // a context frame is pushed for each iteration
+        bool forward{false};        // iterations come from Context::next, count is unused
+        ResolvedKey resolved;       // section key, pushed again for each iteration
+        bool stable{true};          // literal text may be handed to the sink by reference
+        bool observed{false};       // the observer is told when the section is done
+    };
+
+    struct State {
+        const Template *templ{nullptr};
+        std::vector<Frame> frames;
+        size_t bytesWritten{0};
+        bool outermost{false};
+        bool complete{true}; // renders all of the template's nodes
+        size_t lookupBase{0};
+        size_t lookupMissBase{0};
+        SectionObserver *observer{nullptr};
+    };
+
+    // Renders the template's top-level nodes from first to last, all of them by default
+    bool begin(State &state, const Template &templ, Context *context, OutputSink &sink, size_t sizeHint, size_t first = 0,
+            size_t last = std::string::npos)
+    {
+        m_error.clear();
+        m_errorPos = std::nullopt;
+        m_errorPartial.clear();
+
+        if (!templ.valid()) {
+            setError(templ.error(), *templ.errorPos());
+            return false;
+        }
+
+        // Lambdas render their sections through render(), keep counting into the outer render
+        state.outermost = m_renderDepth == 0;
+        if (state.outermost) {
+            m_stats = {};
+            if (m_renderCache) {
+                m_renderCache->clear();
             }
+            state.lookupBase = context->lookupCount();
+            state.lookupMissBase = context->lookupMissCount();
         }
-        else {
-            m_contextStack.push_back(value);
+
+        last = std::min(last, templ.nodes().size());
+        state.complete = first == 0 && last == templ.nodes().size();
+        if (const size_t size = std::max(sizeHint, templ.sizeEstimate()); size > 0 && state.complete) {
+            // Some headroom so that a slightly larger render than the last ones does not reallocate
+            sink.reserve(size + size / 8);
         }
+
+        state.templ = &templ;
+        Frame frame;
+        frame.templ = &templ;
+        frame.nodes = &templ.nodes();
+        frame.index = first;
+        frame.end = last;
+        state.frames.push_back(std::move(frame));
+        return true;
     }
 
-    void pop() override
+    // Renders until the stack is exhausted, or with pausable until the sink is full. Returns true when done.
+    bool run(State &state, Context *context, OutputSink &sink, bool pausable)
     {
-        if (!m_contextStack.empty()) {
-            m_contextStack.pop_back();
+        std::swap(m_bytesWritten, state.bytesWritten);
+        ++m_renderDepth;
+        try {
+            renderFrames(state, context, sink, pausable);
+        } catch (...) {
+            --m_renderDepth;
+            std::swap(m_bytesWritten, state.bytesWritten);
+            throw;
+        }
+        --m_renderDepth;
+        std::swap(m_bytesWritten, state.bytesWritten);
+        return state.frames.empty();
+    }
+
+    void finish(State &state, Context *context)
+    {
+        if (!m_errorPos && state.complete) {
+            state.templ->recordOutputSize(state.bytesWritten);
         }
+        if (state.outermost) {
+            m_stats.lookups = context->lookupCount() - state.lookupBase;
+            m_stats.lookupMisses = context->lookupMissCount() - state.lookupMissBase;
+            m_stats.outputSize = state.bytesWritten;
+        }
+    }
+
+    void write(OutputSink &sink, std::string_view text)
+    {
+        m_bytesWritten += text.size();
+        sink.write(text);
     }
 
-    bool canEval(std::string_view key) const override { return FunctionRegistry::instance().hasFunction(std::string(key)); }
+    void writeCopy(OutputSink &sink, std::string_view text)
+    {
+        m_stats.bytesCopied += text.size();
+        write(sink, text);
+    }
 
-    std::string eval(std::string_view key, std::string_view text, Renderer *renderer) override
+    // Literal text is only passed by reference when its template is known to outlive the sink's use of it
+    void writeLiteral(OutputSink &sink, std::string_view text, bool stable)
     {
-        if (FunctionRegistry::instance().hasFunction(std::string(key))) {
-            return FunctionRegistry::instance().getFunction(std::string(key))(text, renderer, this);
+        if (!stable) {
+            writeCopy(sink, text);
+            return;
         }
-        return {};
-    };
+        m_stats.bytesCopied += text.size();
+        m_bytesWritten += text.size();
+        sink.writeLiteral(text);
+    }
 
-private:
-    std::vector<boost::json::value> m_contextStack;
-};
+    // Counts a freshly built string as an allocation unless it fits the small string buffer
+    void countString(const std::string &value)
+    {
+        static const size_t smallCapacity = std::string().capacity();
+        if (value.capacity() > smallCapacity) {
+            ++m_stats.allocations;
+        }
+    }
 
-inline std::string render(std::string_view templateString, const boost::property_tree::ptree &args)
-{
-    PropertyTreeContext context(args);
-    Renderer renderer;
-    return renderer.render(templateString, &context);
-}
+    void renderFrames(State &state, Context *context, OutputSink &sink, bool pausable)
+    {
+        auto &frames = state.frames;
+        while (!frames.empty()) {
+            if (m_errorPos) {
+                unwind(state, context);
+                return;
+            }
+            if (pausable && sink.full()) {
+                return;
+            }
 
-inline std::string render(std::string_view templateString, const boost::json::value &args)
-{
-    JsonContext context(args);
-    Renderer renderer;
-    return renderer.render(templateString, &context);
+            Frame &frame = frames.back();
+            if (frame.index == frame.end) {
+                if (frame.pushed) {
+                    context->pop();
+                }
+                if (frame.forward) {
+                    if (context->next(frame.node->tag.key)) {
+                        ++frame.iteration;
+                        profileIterations(1);
+                        frame.index = 0;
+                        continue;
+                    }
+                }
+                else if (++frame.iteration < frame.count) {
+                    context->pushResolved(frame.resolved, static_cast<int>(frame.iteration));
+                    frame.index = 0;
+                    continue;
+                }
+                if (frame.observed) {
+                    state.observer->leaveSection();
+                }
+                leave(frame);
+                frames.pop_back();
+                continue;
+            }
+
+            const Template *templ = frame.templ;
+            const bool stable = frame.stable;
+            const Node &node = (*frame.nodes)[frame.index++];
+            const Tag &tag = node.tag;
+            if (tag.type == Tag::type::Null) {
+                writeLiteral(sink, templ->text(node), stable);
+                continue;
+            }
+
+            ++m_stats.tags;
+            profileBegin(tag);
+
+            const bool observed = state.observer
+                    && (tag.type == Tag::type::SectionStart || tag.type == Tag::type::InvertedSectionStart);
+            const size_t depth = frames.size();
+            if (observed) {
+                if (std::optional<std::string_view> output = state.observer->enterSection(*templ, node)) {
+                    write(sink, *output);
+                    profileEnd(tag);
+                    continue;
+                }
+            }
+
+            switch (tag.type) {
+            case Tag::type::Value:
+                renderValue(tag, context, sink);
+                profileEnd(tag);
+                break;
+
+            case Tag::type::SectionStart: {
+                // Looked up once for the count, the truthiness and every push
+                const ResolvedKey resolved = context->resolve(HashedKey{tag.key, tag.hash});
+                size_t listCount = context->resolvedCount(resolved);
+                const bool memoized = m_sectionCache && m_sectionCache->memoizes(tag.key);
+                if (listCount > 0) {
+                    profileIterations(listCount);
+                    if (memoized) {
+                        renderMemoized(templ, node, context, sink, resolved, listCount, true);
+                        profileEnd(tag);
+                    }
+                    else {
+                        context->pushResolved(resolved, 0);
+                        enter(frames, templ, node, node.children, listCount, true, stable);
+                        frames.back().resolved = resolved;
+                    }
+                }
+                else if (context->iterable(tag.key)) {
+                    if (context->next(tag.key)) {
+                        profileIterations(1);
+                        enter(frames, templ, node, node.children, 1, true, stable);
+                        frames.back().forward = true;
+                    }
+                    else {
+                        profileEnd(tag);
+                    }
+                }
+                else if (const Function *function = context->function(tag.key, &node.function)) {
+                    callFunction(*function, templ, node, context, sink, stable);
+                    profileEnd(tag);
+                }
+                else if (context->canEval(tag.key)) {
+                    write(sink, context->eval(tag.key, templ->text(node), this));
+                    profileEnd(tag);
+                }
+                else if (!context->resolvedFalse(resolved)) {
+                    profileIterations(1);
+                    if (memoized) {
+                        renderMemoized(templ, node, context, sink, resolved, 1, false);
+                        profileEnd(tag);
+                    }
+                    else {
+                        context->pushResolved(resolved);
+                        enter(frames, templ, node, node.children, 1, true, stable);
+                    }
+                }
+                else {
+                    profileEnd(tag);
+                }
+                break;
+            }
+
+            case Tag::type::InvertedSectionStart:
+                if (context->isFalse(HashedKey{tag.key, tag.hash})) {
+                    profileIterations(1);
+                    enter(frames, templ, node, node.children, 1, false, stable);
+                }
+                else {
+                    profileEnd(tag);
+                }
+                break;
+
+            case Tag::type::Partial:
+                enterPartial(frames, node, context, sink);
+                break;
+
+            default:
+                break;
+            }
+
+            if (observed) {
+                if (frames.size() > depth) {
+                    frames.back().observed = true;
+                }
+                else {
+                    state.observer->leaveSection();
+                }
+            }
+        }
+    }
+
+    // Forwards to the render's sink, counting what a section function writes
+    class CountingSink : public OutputSink {
+    public:
+        explicit CountingSink(OutputSink &sink) : m_sink(sink) {}
+
+        void write(std::string_view text) override
+        {
+            m_size += text.size();
+            m_sink.write(text);
+        }
+        void writeLiteral(std::string_view text) override
+        {
+            m_size += text.size();
+            m_sink.writeLiteral(text);
+        }
+        bool retain(const std::shared_ptr<const Template> &templ) override { return m_sink.retain(templ); }
+        void reserve(size_t size) override { m_sink.reserve(size); }
+        bool full() const override { return m_sink.full(); }
+
+        size_t size() const { return m_size; }
+
+    private:
+        OutputSink &m_sink;
+        size_t m_size{0};
+    };
+
+    void callFunction(const Function &function, const Template *templ, const Node &node, Context *context, OutputSink &sink,
+            bool stable)
+    {
+        if (function.pure) {
+            callPureFunction(function, templ, node, context, sink);
+            return;
+        }
+        if (!function.section) {
+            write(sink, function.text(templ->text(node), this, context));
+            return;
+        }
+        CountingSink counted(sink);
+        function.section(Section(this, context, templ, &node, &counted, stable), counted);
+        m_bytesWritten += counted.size();
+    }
+
+    void callPureFunction(const Function &function, const Template *templ, const Node &node, Context *context,
+            OutputSink &sink)
+    {
+        std::string input;
+        StringSink inputSink(input);
+        renderSection(*templ, node, context, inputSink, false);
+        m_stats.allocations += inputSink.allocations();
+        if (m_errorPos) {
+            return;
+        }
+
+        FunctionCache *cache = m_functionCache.get();
+        if (!cache) {
+            if (!m_renderCache) {
+                m_renderCache = std::make_unique<FunctionCache>();
+            }
+            cache = m_renderCache.get();
+        }
+        if (std::optional<std::string> output = cache->find(&function, input)) {
+            ++m_stats.functionCacheHits;
+            write(sink, *output);
+            return;
+        }
+        std::string output = function.pure(input);
+        write(sink, output);
+        cache->insert(&function, std::move(input), std::move(output));
+    }
+
+    // Renders each iteration of a memoized section from the cache, or renders and caches it
+    void renderMemoized(const Template *templ, const Node &node, Context *context, OutputSink &sink,
+            const ResolvedKey &resolved, size_t count, bool list)
+    {
+        for (size_t iteration = 0; iteration < count && !m_errorPos; ++iteration) {
+            context->pushResolved(resolved, list ? static_cast<int>(iteration) : -1);
+
+            std::optional<std::string> data = context->frameKey();
+            std::optional<std::string> output;
+            if (data) {
+                output = m_sectionCache->find(templ->id(), node.start, *data);
+            }
+            if (output) {
+                ++m_stats.sectionCacheHits;
+                write(sink, *output);
+            }
+            else {
+                std::string body;
+                StringSink bodySink(body);
+                renderSection(*templ, node, context, bodySink, false);
+                m_stats.allocations += bodySink.allocations();
+                write(sink, body);
+                if (data && !m_errorPos) {
+                    m_sectionCache->insert(templ->id(), node.start, std::move(*data), std::move(body));
+                }
+            }
+            context->pop();
+        }
+    }
+
+    // Renders a section body on its own stack, on behalf of a section function
+    void renderSection(const Template &templ, const Node &node, Context *context, OutputSink &sink, bool stable)
+    {
+        State state;
+        state.templ = &templ;
+        Frame frame;
+        frame.templ = &templ;
+        frame.nodes = &node.children;
+        frame.end = node.children.size();
+        frame.stable = stable;
+        state.frames.push_back(std::move(frame));
+        run(state, context, sink, false);
+    }
+
+    void renderValue(const Tag &tag, Context *context, OutputSink &sink)
+    {
+        if (const auto view = context->typedValue(HashedKey{tag.key, tag.hash})) {
+            renderValue(tag, *view, sink);
+            return;
+        }
+
+        std::string value = context->stringValue(tag.key);
+        countString(value);
+        if (tag.escapeMode == Tag::escape_mode::Escape) {
+            ++m_stats.escapes;
+            m_stats.bytesEscaped += value.size();
+            writeEscaped(sink, value);
+        }
+        else if (tag.escapeMode == Tag::escape_mode::Unescape) {
+            writeUnescaped(sink, value);
+        }
+        else {
+            writeCopy(sink, value);
+        }
+    }
+
+    // Numbers are formatted on the stack and strings escaped while written, without building a string
+    void renderValue(const Tag &tag, const ValueView &value, OutputSink &sink)
+    {
+        char buffer[64];
+        std::string_view text;
+        switch (value.type) {
+        case ValueView::type::String:
+            text = value.string;
+            break;
+        case ValueView::type::Int:
+            text = std::string_view(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value.integer).ptr - buffer);
+            break;
+        case ValueView::type::Uint:
+            text = std::string_view(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value.unsignedInteger).ptr - buffer);
+            break;
+        case ValueView::type::Double:
+            text = formatDouble(value.real, buffer, sizeof(buffer));
+            break;
+        case ValueView::type::Bool:
+            text = value.boolean ? "true" : "false";
+            break;
+        case ValueView::type::Null:
+            break;
+        }
+
+        std::string formatted;
+        if (value.type == ValueView::type::Double && text.empty()) {
+            // Too long for the buffer, or no floating point to_chars
+            std::ostringstream oss;
+            if (std::floor(value.real) == value.real) {
+                oss << std::fixed << std::setprecision(0) << value.real;
+            }
+            else {
+                oss << std::defaultfloat << std::setprecision(6) << value.real;
+            }
+            formatted = oss.str();
+            countString(formatted);
+            text = formatted;
+        }
+
+        if (tag.escapeMode == Tag::escape_mode::Escape) {
+            ++m_stats.escapes;
+            m_stats.bytesEscaped += text.size();
+            if (value.type == ValueView::type::String) {
+                writeEscaped(sink, text);
+            }
+            else {
+                write(sink, text);
+            }
+        }
+        else if (tag.escapeMode == Tag::escape_mode::Unescape && value.type == ValueView::type::String) {
+            writeUnescaped(sink, text);
+        }
+        else {
+            writeCopy(sink, text);
+        }
+    }
+
+    // Integral values without a fraction, others with six significant digits, empty if it does not fit
+    static std::string_view formatDouble(double value, char *buffer, size_t size)
+    {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        const bool integral = std::floor(value) == value;
+        const auto result = std::to_chars(buffer, buffer + size, value,
+                integral ? std::chars_format::fixed : std::chars_format::general, integral ? 0 : 6);
+        if (result.ec == std::errc()) {
+            return std::string_view(buffer, result.ptr - buffer);
+        }
+#else
+        (void)value;
+        (void)buffer;
+        (void)size;
+#endif
+        return {};
+    }
+
+    // Gathers small pieces of output on the stack and hands them to the sink in larger writes
+    class StackBuffer {
+    public:
+        // Copied output counts as unescaped bytes written, see RenderStats::bytesCopied
+        StackBuffer(Renderer &renderer, OutputSink &sink, bool copied) : m_renderer(renderer), m_sink(sink), m_copied(copied) {}
+
+        void append(std::string_view part)
+        {
+            if (part.size() > sizeof(m_data) - m_used) {
+                flush();
+                if (part.size() > sizeof(m_data)) {
+                    output(part);
+                    return;
+                }
+            }
+            std::memcpy(m_data + m_used, part.data(), part.size());
+            m_used += part.size();
+        }
+
+        void flush()
+        {
+            if (m_used > 0) {
+                output(std::string_view(m_data, m_used));
+                m_used = 0;
+            }
+        }
+
+    private:
+        void output(std::string_view text)
+        {
+            if (m_copied) {
+                m_renderer.writeCopy(m_sink, text);
+            }
+            else {
+                m_renderer.write(m_sink, text);
+            }
+        }
+
+        Renderer &m_renderer;
+        OutputSink &m_sink;
+        bool m_copied;
+        size_t m_used{0};
+        char m_data[256];
+    };
+
+    // Escapes text while writing it, through a stack buffer unless it has nothing to escape
+    void writeEscaped(OutputSink &sink, std::string_view text)
+    {
+        static constexpr std::string_view specials = "&<>\"";
+        size_t special = text.find_first_of(specials);
+        if (special == std::string_view::npos) {
+            write(sink, text);
+            return;
+        }
+
+        StackBuffer buffer(*this, sink, false);
+        size_t start = 0;
+        for (;;) {
+            buffer.append(text.substr(start, special - start));
+            if (special == std::string_view::npos) {
+                break;
+            }
+            switch (text[special]) {
+            case '&':
+                buffer.append("&amp;");
+                break;
+            case '<':
+                buffer.append("&lt;");
+                break;
+            case '>':
+                buffer.append("&gt;");
+                break;
+            default:
+                buffer.append("&quot;");
+                break;
+            }
+            start = special + 1;
+            special = text.find_first_of(specials, start);
+        }
+        buffer.flush();
+    }
+
+    // Decodes entities in a single pass while writing, finding them with memchr and writing the text between
+    // them as it is. Entities that are not decoded are written unchanged.
+    void writeUnescaped(OutputSink &sink, std::string_view text)
+    {
+        const char *data = text.data();
+        const char *amp = static_cast<const char *>(std::memchr(data, '&', text.size()));
+        if (!amp) {
+            writeCopy(sink, text);
+            return;
+        }
+
+        StackBuffer buffer(*this, sink, true);
+        size_t start = 0;
+        while (amp) {
+            const size_t pos = amp - data;
+            char decodedData[4];
+            size_t length = 0;
+            const std::string_view decoded = decodeEntity(text.substr(pos + 1), decodedData, length);
+            size_t next = pos + 1;
+            if (!decoded.empty()) {
+                buffer.append(text.substr(start, pos - start));
+                buffer.append(decoded);
+                start = next = pos + 1 + length;
+            }
+            amp = next < text.size() ? static_cast<const char *>(std::memchr(data + next, '&', text.size() - next)) : nullptr;
+        }
+        buffer.append(text.substr(start));
+        buffer.flush();
+    }
+
+    // Decodes the entity following an ampersand, setting length to the characters it takes after the ampersand.
+    // Only the entities escaping produces unless BOOST_MUSTACHE_FULL_ENTITIES is defined, which adds numeric
+    // references and the HTML 4 named ones. Empty if there is no entity to decode.
+    static std::string_view decodeEntity(std::string_view entity, char *buffer, size_t &length)
+    {
+        static constexpr std::pair<std::string_view, std::string_view> escapes[] = {
+                {"lt;", "<"}, {"gt;", ">"}, {"quot;", "\""}, {"amp;", "&"}};
+        for (const auto &[name, decoded] : escapes) {
+            if (entity.substr(0, name.size()) == name) {
+                length = name.size();
+                return decoded;
+            }
+        }
+
+#ifdef BOOST_MUSTACHE_FULL_ENTITIES
+        // Named references are at most eight characters, numeric ones that fit in a code point at most nine
+        const size_t end = entity.substr(0, 10).find(';');
+        if (end == std::string_view::npos || end == 0) {
+            return {};
+        }
+        const std::string_view name = entity.substr(0, end);
+
+        char32_t codePoint = 0;
+        if (name[0] == '#') {
+            const bool hex = name.size() > 1 && (name[1] == 'x' || name[1] == 'X');
+            const std::string_view digits = name.substr(hex ? 2 : 1);
+            uint32_t value = 0;
+            const auto result = std::from_chars(digits.data(), digits.data() + digits.size(), value, hex ? 16 : 10);
+            if (digits.empty() || result.ec != std::errc() || result.ptr != digits.data() + digits.size()) {
+                return {};
+            }
+            codePoint = value;
+        }
+        else {
+            codePoint = namedEntity(name);
+        }
+        if (codePoint == 0 || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+            return {};
+        }
+
+        length = end + 1;
+        return encodeUtf8(codePoint, buffer);
+#else
+        (void)buffer;
+        return {};
+#endif
+    }
+
+#ifdef BOOST_MUSTACHE_FULL_ENTITIES
+    static std::string_view encodeUtf8(char32_t codePoint, char *buffer)
+    {
+        if (codePoint < 0x80) {
+            buffer[0] = static_cast<char>(codePoint);
+            return std::string_view(buffer, 1);
+        }
+        if (codePoint < 0x800) {
+            buffer[0] = static_cast<char>(0xC0 | (codePoint >> 6));
+            buffer[1] = static_cast<char>(0x80 | (codePoint & 0x3F));
+            return std::string_view(buffer, 2);
+        }
+        if (codePoint < 0x10000) {
+            buffer[0] = static_cast<char>(0xE0 | (codePoint >> 12));
+            buffer[1] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            buffer[2] = static_cast<char>(0x80 | (codePoint & 0x3F));
+            return std::string_view(buffer, 3);
+        }
+        buffer[0] = static_cast<char>(0xF0 | (codePoint >> 18));
+        buffer[1] = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        buffer[2] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        buffer[3] = static_cast<char>(0x80 | (codePoint & 0x3F));
+        return std::string_view(buffer, 4);
+    }
+#endif
+
+    static void enter(std::vector<Frame> &frames, const Template *templ, const Node &node, const std::vector<Node> &nodes,
+            size_t count, bool pushed, bool stable)
+    {
+        Frame frame;
+        frame.templ = templ;
+        frame.nodes = &nodes;
+        frame.end = nodes.size();
+        frame.node = &node;
+        frame.count = count;
+        frame.pushed = pushed;
+        frame.stable = stable;
+        frames.push_back(std::move(frame));
+    }
+
+    void enterPartial(std::vector<Frame> &frames, const Node &node, Context *context, OutputSink &sink)
+    {
+        const Tag &tag = node.tag;
+        m_partialStack.push_back(tag.key);
+
+        std::shared_ptr<const Template> partial = partialTemplate(tag, context, frames.back().templ->functions());
+        if (!partial->valid()) {
+            setError(partial->error(), *partial->errorPos());
+            m_partialStack.pop_back();
+            profileEnd(tag);
+            return;
+        }
+
+        if (tag.indentation > 0) {
+            write(sink, std::string(tag.indentation, ' '));
+        }
+        const bool stable = sink.retain(partial);
+        enter(frames, partial.get(), node, partial->nodes(), 1, false, stable);
+        frames.back().partial = std::move(partial);
+    }
+
+    // Bookkeeping when a section or partial body is done
+    void leave(const Frame &frame)
+    {
+        if (!frame.node) {
+            return;
+        }
+        if (frame.node->tag.type == Tag::type::Partial) {
+            m_partialStack.pop_back();
+        }
+        profileEnd(frame.node->tag);
+    }
+
+    // Drops the remaining frames after an error, the way returning from nested calls used to
+    void unwind(State &state, Context *context)
+    {
+        while (!state.frames.empty()) {
+            const Frame &frame = state.frames.back();
+            if (frame.pushed) {
+                context->pop();
+            }
+            if (frame.observed) {
+                state.observer->leaveSection();
+            }
+            leave(frame);
+            state.frames.pop_back();
+        }
+    }
+
+    // Partials are compiled once per name and indentation, and again only when the resolver returns new content
+    // Partials inherit the functions attached to the including template
+    std::shared_ptr<const Template> partialTemplate(const Tag &tag, Context *context,
+            const std::shared_ptr<const FunctionSet> &functions)
+    {
+        std::string content = context->partialValue(tag.key);
+        auto &entry = m_partials[{tag.key, tag.indentation}];
+        if (entry.templ && entry.content == content && entry.templ->functions() == functions) {
+            return entry.templ;
+        }
+
+        std::string source = content;
+        if (tag.indentation > 0) {
+            size_t pos = 0;
+            while ((pos = source.find('\n', pos)) != std::string::npos) {
+                if (pos < source.length() - 1) {
+                    source.insert(pos + 1, std::string(tag.indentation, ' '));
+                }
+                pos += tag.indentation + 1;
+            }
+        }
+
+        auto partial = std::make_shared<Template>(compile(std::move(source)));
+        if (functions) {
+            partial->setFunctions(functions);
+        }
+        entry.templ = std::move(partial);
+        entry.content = std::move(content);
+        return entry.templ;
+    }
+
+#ifdef BOOST_MUSTACHE_PROFILING
+    struct ProfileFrame {
+        enum Tag::type type{Tag::type::Null};
+        size_t iterations{0};
+        size_t depth{1};
+        size_t stackSize{0};
+        size_t bytesStart{0};
+        std::chrono::nanoseconds children{0};
+        std::chrono::steady_clock::time_point start;
+    };
+#endif
+
+    // Starts timing a tag; every profileBegin() is matched by a profileEnd() once the tag and its body are done.
+    // A suspended stream keeps the clock running, so stream timings include the time spent between chunks.
+    void profileBegin(const Tag &tag)
+    {
+#ifdef BOOST_MUSTACHE_PROFILING
+        if (!m_profiler) {
+            return;
+        }
+        ProfileFrame frame;
+        frame.type = tag.type;
+        if (!m_profileFrames.empty()) {
+            // Only rendered sections push a context frame; inverted sections, lambdas and partials do not
+            const auto &parent = m_profileFrames.back();
+            frame.depth = parent.depth + (parent.type == Tag::type::SectionStart && parent.iterations > 0 ? 1 : 0);
+        }
+        frame.stackSize = m_profileStack.size();
+        if (frame.stackSize > 0) {
+            m_profileStack += ';';
+        }
+        switch (tag.type) {
+        case Tag::type::SectionStart:
+            m_profileStack += '#';
+            break;
+        case Tag::type::InvertedSectionStart:
+            m_profileStack += '^';
+            break;
+        case Tag::type::Partial:
+            m_profileStack += '>';
+            break;
+        default:
+            break;
+        }
+        m_profileStack += tag.key;
+        frame.bytesStart = m_bytesWritten;
+        frame.start = std::chrono::steady_clock::now();
+        m_profileFrames.push_back(frame);
+#else
+        (void)tag;
+#endif
+    }
+
+    void profileEnd(const Tag &tag)
+    {
+#ifdef BOOST_MUSTACHE_PROFILING
+        if (!m_profiler || m_profileFrames.empty()) {
+            return;
+        }
+        const auto frame = m_profileFrames.back();
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frame.start);
+        m_profileFrames.pop_back();
+        if (!m_profileFrames.empty()) {
+            m_profileFrames.back().children += elapsed;
+        }
+
+        TagProfile sample;
+        if (!m_partialStack.empty()) {
+            sample.templateName = m_partialStack.back();
+        }
+        sample.key = tag.key;
+        sample.type = tag.type;
+        sample.position = tag.start;
+        sample.stack = m_profileStack;
+        sample.elapsed = elapsed;
+        sample.self = elapsed - frame.children;
+        sample.iterations = frame.iterations;
+        sample.bytes = m_bytesWritten - frame.bytesStart;
+        sample.depth = frame.depth;
+        m_profiler->tagRendered(sample);
+        m_profileStack.resize(frame.stackSize);
+#else
+        (void)tag;
+#endif
+    }
+
+    void profileIterations(size_t count)
+    {
+#ifdef BOOST_MUSTACHE_PROFILING
+        if (m_profiler && !m_profileFrames.empty()) {
+            m_profileFrames.back().iterations += count;
+        }
+#else
+        (void)count;
+#endif
+    }
+
+    void setError(std::string_view error, size_t pos)
+    {
+        m_error = std::string(error);
+        m_errorPos = pos;
+        if (!m_partialStack.empty()) {
+            m_errorPartial = m_partialStack.back();
+        }
+    }
+
+private:
+    std::vector<std::string> m_partialStack;
+    std::map<std::pair<std::string, size_t>, PartialEntry> m_partials;
+    std::string m_error;
+    std::optional<size_t> m_errorPos;
+    std::string m_errorPartial;
+    std::string m_defaultTagStartMarker;
+    std::string m_defaultTagEndMarker;
+    RenderStats m_stats;
+    size_t m_renderDepth{0};
+    size_t m_bytesWritten{0};
+    std::shared_ptr<FunctionCache> m_functionCache;
+    std::unique_ptr<FunctionCache> m_renderCache; // used without a shared cache, cleared on each render
+    std::shared_ptr<SectionCache> m_sectionCache;
+#ifdef BOOST_MUSTACHE_PROFILING
+    std::shared_ptr<RenderProfiler> m_profiler;
+    std::vector<ProfileFrame> m_profileFrames;
+    std::string m_profileStack;
+#endif
+};
+
+inline void Section::render(OutputSink &sink) const
+{
+    m_renderer->renderSection(*m_templ, *m_node, m_context, sink, m_stable && &sink == m_sink);
+}
+
+inline std::string Section::render() const
+{
+    std::string output;
+    StringSink sink(output);
+    render(sink);
+    m_renderer->m_stats.allocations += sink.allocations();
+    return output;
+}
+
+// Pull-based renderer producing the output of a compiled template in bounded chunks.
+// The template and the context must outlive the stream.
+class RenderStream {
+public:
+    RenderStream(const Template &templ, Context *context) : m_context(context)
+    {
+        NullSink sink;
+        m_finished = !m_renderer.begin(m_state, templ, context, sink, 0);
+    }
+
+    // Copies up to capacity bytes of output into buffer and returns their count, 0 once the output is complete
+    size_t nextChunk(char *buffer, size_t capacity)
+    {
+        ChunkSink sink(buffer, capacity, m_pending);
+        if (m_pendingOffset < m_pending.size()) {
+            const size_t size = std::min(capacity, m_pending.size() - m_pendingOffset);
+            sink.write(std::string_view(m_pending).substr(m_pendingOffset, size));
+            m_pendingOffset += size;
+        }
+        if (m_pendingOffset == m_pending.size()) {
+            m_pending.clear();
+            m_pendingOffset = 0;
+        }
+
+        if (!m_finished && !sink.full()) {
+            m_finished = m_renderer.run(m_state, m_context, sink, true);
+            if (m_finished) {
+                m_renderer.finish(m_state, m_context);
+            }
+        }
+        return sink.size();
+    }
+
+    bool done() const { return m_finished && m_pending.empty(); }
+
+    // The renderer is exposed for its error and statistics, and to set a profiler before the first chunk
+    Renderer &renderer() { return m_renderer; }
+    const Renderer &renderer() const { return m_renderer; }
+
+private:
+    class NullSink : public OutputSink {
+    public:
+        void write(std::string_view) override {}
+    };
+
+    // Fills the caller's buffer and spills what does not fit into the stream's pending buffer
+    class ChunkSink : public OutputSink {
+    public:
+        ChunkSink(char *buffer, size_t capacity, std::string &pending)
+            : m_buffer(buffer), m_capacity(capacity), m_pending(pending)
+        {
+        }
+
+        void write(std::string_view text) override
+        {
+            const size_t size = std::min(text.size(), m_capacity - m_size);
+            std::memcpy(m_buffer + m_size, text.data(), size);
+            m_size += size;
+            if (size < text.size()) {
+                m_pending.append(text.substr(size));
+            }
+        }
+
+        bool full() const override { return m_size == m_capacity; }
+        size_t size() const { return m_size; }
+
+    private:
+        char *m_buffer;
+        size_t m_capacity;
+        size_t m_size{0};
+        std::string &m_pending;
+    };
+
+    Renderer m_renderer;
+    Renderer::State m_state;
+    Context *m_context;
+    std::string m_pending;
+    size_t m_pendingOffset{0};
+    bool m_finished{false};
+};
+
+// Renders a compiled template, then on data changes re-renders only the sections that looked up changed data,
+// at any depth, splicing the output of the others from the previous output. Each section records the output
+// range and the data paths of its own lookups, its key's included; a section with a changed descendant renders
+// its own tags again and reuses its unaffected nested sections. Functions are assumed to depend on nothing but
+// the data they look up. Contexts that do not support dependency tracking re-render everything.
+// The template must outlive the renderer.
+class IncrementalRenderer {
+public:
+    explicit IncrementalRenderer(const Template &templ) : m_templ(templ) {}
+
+    const std::string &render(Context *context)
+    {
+        renderTemplate(context, nullptr);
+        return m_output;
+    }
+
+    // Changed paths are dot separated data paths as the context records them, e.g. "items.2.price".
+    // A change to a path affects everything below it.
+    const std::string &update(Context *context, const std::vector<std::string> &changedPaths)
+    {
+        if (!m_rendered || !context->supportsDependencies()) {
+            return render(context);
+        }
+        if (!mark(m_root, changedPaths)) {
+            m_renderedSections = 0;
+            return m_output;
+        }
+        Segment previous = std::move(m_root);
+        renderTemplate(context, &previous);
+        return m_output;
+    }
+
+    const std::string &output() const { return m_output; }
+
+    // Sections rendered by the last render or update rather than spliced from the previous output
+    size_t renderedSections() const { return m_renderedSections; }
+
+    const Renderer &renderer() const { return m_renderer; }
+
+private:
+    // The whole template or one section, with all its iterations. Offsets are relative to the enclosing segment.
+    struct Segment {
+        const Template *templ{nullptr};
+        const Node *node{nullptr};
+        size_t offset{0};
+        size_t size{0};
+        std::vector<std::string> dependencies; // lookups outside nested sections
+        std::vector<Segment> children;         // nested sections in render order
+        bool dirty{false};                     // set by mark() for the segment or one of its descendants
+    };
+
+    // Builds the segment tree while rendering, reusing the previous output of unaffected sections. Sections
+    // reached at the same position of a segment render in the same context frames, so they match by position.
+    class Tracker : public Renderer::SectionObserver {
+    public:
+        Tracker(IncrementalRenderer &owner, Context *context, const std::string &output, Segment *previous)
+            : m_owner(owner), m_context(context), m_output(output)
+        {
+            m_levels.push_back({{}, previous, 0, 0, 0});
+            track();
+        }
+
+        std::optional<std::string_view> enterSection(const Template &templ, const Node &node) override
+        {
+            Level &parent = m_levels.back();
+            Segment *previous = nullptr;
+            size_t previousStart = 0;
+            if (parent.previous && parent.next < parent.previous->children.size()) {
+                Segment &candidate = parent.previous->children[parent.next++];
+                if (candidate.templ == &templ && candidate.node == &node) {
+                    previous = &candidate;
+                    previousStart = parent.previousStart + candidate.offset;
+                }
+                else {
+                    // The sections no longer line up, render the rest of this segment afresh
+                    parent.previous = nullptr;
+                }
+            }
+
+            const size_t start = m_output.size();
+            if (previous && !previous->dirty) {
+                Segment segment = std::move(*previous);
+                segment.offset = start - parent.start;
+                parent.segment.children.push_back(std::move(segment));
+                return std::string_view(m_owner.m_output).substr(previousStart, parent.segment.children.back().size);
+            }
+
+            Segment segment;
+            segment.templ = &templ;
+            segment.node = &node;
+            segment.offset = start - parent.start;
+            m_levels.push_back({std::move(segment), previous, previousStart, start, 0});
+            ++m_owner.m_renderedSections;
+            track();
+            return std::nullopt;
+        }
+
+        void leaveSection() override
+        {
+            Level level = std::move(m_levels.back());
+            m_levels.pop_back();
+            finish(level);
+            m_levels.back().segment.children.push_back(std::move(level.segment));
+            track();
+        }
+
+        Segment root()
+        {
+            finish(m_levels.front());
+            m_context->trackDependencies(nullptr);
+            return std::move(m_levels.front().segment);
+        }
+
+    private:
+        struct Level {
+            Segment segment;
+            Segment *previous;    // same segment in the previous render, null when rendering afresh
+            size_t previousStart; // absolute offset of previous in the previous output
+            size_t start;         // absolute offset of segment in the output
+            size_t next;          // position of the next nested section
+        };
+
+        void track() { m_context->trackDependencies(&m_levels.back().segment.dependencies); }
+
+        void finish(Level &level)
+        {
+            auto &dependencies = level.segment.dependencies;
+            std::sort(dependencies.begin(), dependencies.end());
+            dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+            level.segment.size = m_output.size() - level.start;
+        }
+
+        IncrementalRenderer &m_owner;
+        Context *m_context;
+        const std::string &m_output;
+        std::vector<Level> m_levels;
+    };
+
+    void renderTemplate(Context *context, Segment *previous)
+    {
+        m_renderedSections = 0;
+        m_rendered = false;
+        std::string output;
+        output.reserve(m_output.size());
+        StringSink sink(output);
+        Tracker tracker(*this, context, output, previous);
+        Renderer::State state;
+        state.observer = &tracker;
+        try {
+            if (m_renderer.begin(state, m_templ, context, sink, 0)) {
+                m_renderer.run(state, context, sink, false);
+                m_renderer.finish(state, context);
+            }
+        } catch (...) {
+            context->trackDependencies(nullptr);
+            throw;
+        }
+        m_root = tracker.root();
+        m_output = std::move(output);
+        // Start over on the next update after an error
+        m_rendered = !m_renderer.errorPos();
+    }
+
+    // Flags the segments whose own lookups or whose descendants' lookups changed
+    static bool mark(Segment &segment, const std::vector<std::string> &changedPaths)
+    {
+        segment.dirty = affected(segment, changedPaths);
+        for (auto &child : segment.children) {
+            segment.dirty = mark(child, changedPaths) || segment.dirty;
+        }
+        return segment.dirty;
+    }
+
+    static bool affected(const Segment &segment, const std::vector<std::string> &changedPaths)
+    {
+        for (const auto &changed : changedPaths) {
+            for (const auto &dependency : segment.dependencies) {
+                if (overlaps(changed, dependency)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // True if one path lies within the other
+    static bool overlaps(std::string_view a, std::string_view b)
+    {
+        if (a.size() > b.size()) {
+            std::swap(a, b);
+        }
+        return b.compare(0, a.size(), a) == 0 && (a.empty() || a.size() == b.size() || b[a.size()] == '.');
+    }
+
+    const Template &m_templ;
+    Renderer m_renderer;
+    std::string m_output;
+    Segment m_root;
+    size_t m_renderedSections{0};
+    bool m_rendered{false};
+};
+
+#ifdef BOOST_MUSTACHE_HAS_COROUTINES
+// Coroutine generator of output chunks, see renderGenerator().
+// Each chunk is valid until the generator is resumed.
+class RenderGenerator {
+public:
+    struct promise_type {
+        std::string_view chunk;
+        std::exception_ptr exception;
+
+        RenderGenerator get_return_object() { return RenderGenerator(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        std::suspend_always yield_value(std::string_view value) noexcept
+        {
+            chunk = value;
+            return {};
+        }
+
+        void return_void() noexcept {}
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    using handle = std::coroutine_handle<promise_type>;
+
+    class iterator {
+    public:
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(handle coroutine) : m_coroutine(coroutine) {}
+
+        std::string_view operator*() const { return m_coroutine.promise().chunk; }
+
+        iterator &operator++()
+        {
+            resume(m_coroutine);
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return !m_coroutine || m_coroutine.done(); }
+
+    private:
+        handle m_coroutine;
+    };
+
+    RenderGenerator(RenderGenerator &&other) noexcept
+        : m_coroutine(std::exchange(other.m_coroutine, {})), m_stream(std::move(other.m_stream))
+    {
+    }
+
+    RenderGenerator &operator=(RenderGenerator &&other) noexcept
+    {
+        if (this != &other) {
+            if (m_coroutine) {
+                m_coroutine.destroy();
+            }
+            m_coroutine = std::exchange(other.m_coroutine, {});
+            m_stream = std::move(other.m_stream);
+        }
+        return *this;
+    }
+
+    ~RenderGenerator()
+    {
+        if (m_coroutine) {
+            m_coroutine.destroy();
+        }
+    }
+
+    iterator begin()
+    {
+        resume(m_coroutine);
+        return iterator(m_coroutine);
+    }
+
+    std::default_sentinel_t end() const { return {}; }
+
+    // Error and statistics of the render, complete once all chunks have been consumed
+    const Renderer &renderer() const { return m_stream->renderer(); }
+
+private:
+    friend RenderGenerator renderGenerator(const Template &, Context *, size_t);
+
+    explicit RenderGenerator(handle coroutine) : m_coroutine(coroutine) {}
+
+    static void resume(handle coroutine)
+    {
+        if (coroutine && !coroutine.done()) {
+            coroutine.resume();
+            if (coroutine.promise().exception) {
+                std::rethrow_exception(std::exchange(coroutine.promise().exception, nullptr));
+            }
+        }
+    }
+
+    static RenderGenerator generate(std::shared_ptr<RenderStream> stream, size_t bufferSize)
+    {
+        auto buffer = std::make_unique<char[]>(bufferSize);
+        while (size_t size = stream->nextChunk(buffer.get(), bufferSize)) {
+            co_yield std::string_view(buffer.get(), size);
+        }
+    }
+
+    handle m_coroutine;
+    std::shared_ptr<RenderStream> m_stream;
+};
+
+// Renders a compiled template lazily, suspending each time bufferSize bytes of output are ready.
+// The template and the context must outlive the generator.
+inline RenderGenerator renderGenerator(const Template &templ, Context *context, size_t bufferSize = 16 * 1024)
+{
+    auto stream = std::make_shared<RenderStream>(templ, context);
+    RenderGenerator generator = RenderGenerator::generate(stream, bufferSize);
+    generator.m_stream = std::move(stream);
+    return generator;
+}
+#endif
+
+// Add new JsonContext class
+class JsonContext : public Context {
+public:
+    // Renders a copy of root
+    explicit JsonContext(const boost::json::value &root, std::shared_ptr<PartialResolver> resolver = nullptr)
+        : Context(std::move(resolver)), m_root(std::make_unique<boost::json::value>(root))
+    {
+        m_contextStack.emplace_back(m_root.get());
+        m_paths.emplace_back();
+    }
+
+    // Renders root in place, it must outlive the context and not change while the context is in use
+    explicit JsonContext(const boost::json::value *root, std::shared_ptr<PartialResolver> resolver = nullptr)
+        : Context(std::move(resolver))
+    {
+        m_contextStack.emplace_back(root);
+        m_paths.emplace_back();
+    }
+
+    boost::json::value getValue(std::string_view key) const
+    {
+        size_t frame;
+        const boost::json::value *value = lookup(key, keyHash(key), frame);
+        return value ? *value : boost::json::value();
+    }
+
+    bool isFalse(std::string_view key) const override { return isFalse(HashedKey{key, keyHash(key)}); }
+
+    bool isFalse(const HashedKey &key) const override
+    {
+        size_t frame;
+        return isFalseValue(lookup(key.key, key.hash, frame));
+    }
+
+    std::string stringValue(std::string_view key) const override
+    {
+        size_t frame;
+        const boost::json::value *value = lookup(key, keyHash(key), frame);
+        if (!value) {
+            return {};
+        }
+
+        if (value->is_double()) {
+            std::ostringstream oss;
+            oss.precision(6);
+
+            if (const auto dvalue = value->as_double(); std::floor(dvalue) == dvalue) {
+                oss << std::fixed << std::setprecision(0) << dvalue;
+            }
+            else {
+                oss << std::defaultfloat << dvalue;
+            }
+            return oss.str();
+        }
+
+        if (value->is_string()) {
+            return std::string(value->as_string());
+        }
+
+        if (value->is_bool()) {
+            return value->as_bool() ? "true" : "false";
+        }
+
+        if (value->is_number()) {
+            return std::to_string(value->as_int64());
+        }
+
+        return {};
+    }
+
+    std::optional<ValueView> typedValue(std::string_view key) const override
+    {
+        return typedValue(HashedKey{key, keyHash(key)});
+    }
+
+    std::optional<ValueView> typedValue(const HashedKey &key) const override
+    {
+        size_t frame;
+        const boost::json::value *value = lookup(key.key, key.hash, frame);
+        ValueView view;
+        if (!value) {
+            return view;
+        }
+
+        switch (value->kind()) {
+        case boost::json::kind::string: {
+            const auto &str = value->as_string();
+            view.type = ValueView::type::String;
+            view.string = std::string_view(str.data(), str.size());
+            break;
+        }
+        case boost::json::kind::int64:
+            view.type = ValueView::type::Int;
+            view.integer = value->as_int64();
+            break;
+        case boost::json::kind::uint64:
+            view.type = ValueView::type::Uint;
+            view.unsignedInteger = value->as_uint64();
+            break;
+        case boost::json::kind::double_:
+            view.type = ValueView::type::Double;
+            view.real = value->as_double();
+            break;
+        case boost::json::kind::bool_:
+            view.type = ValueView::type::Bool;
+            view.boolean = value->as_bool();
+            break;
+        default:
+            break;
+        }
+        return view;
+    }
+
+    size_t listCount(std::string_view key) const override { return resolvedCount(resolve(key)); }
+
+    void push(std::string_view key, int index = -1) override { pushResolved(resolve(key), index); }
+
+    ResolvedKey resolve(std::string_view key) const override { return resolve(HashedKey{key, keyHash(key)}); }
+
+    ResolvedKey resolve(const HashedKey &key) const override
+    {
+        ResolvedKey resolved{key.key};
+        resolved.value = lookup(key.key, key.hash, resolved.frame);
+        return resolved;
+    }
+
+    size_t resolvedCount(const ResolvedKey &resolved) const override
+    {
+        const auto *value = static_cast<const boost::json::value *>(resolved.value);
+        return value && value->is_array() ? value->as_array().size() : 0;
+    }
+
+    bool resolvedFalse(const ResolvedKey &resolved) const override
+    {
+        return isFalseValue(static_cast<const boost::json::value *>(resolved.value));
+    }
+
+    // Frames point into the data, nothing is copied
+    void pushResolved(const ResolvedKey &resolved, int index = -1) override
+    {
+        pushPath(resolved.key, resolved.frame, index);
+
+        const auto *value = static_cast<const boost::json::value *>(resolved.value);
+        if (value && index >= 0 && value->is_array()) {
+            const auto &arr = value->as_array();
+            value = static_cast<size_t>(index) < arr.size() ? &arr[index] : nullptr;
+        }
+        m_contextStack.emplace_back(value).transient = m_contextStack[resolved.frame].transient;
+    }
+
+    void pop() override
+    {
+        if (!m_contextStack.empty()) {
+            m_contextStack.pop_back();
+            m_paths.pop_back();
+        }
+    }
+
+    bool supportsDependencies() const override { return true; }
+
+    std::optional<std::string> frameKey() const override
+    {
+        std::string key;
+        const boost::json::value *value = m_contextStack.back().value;
+        encodeValue(key, value ? *value : boost::json::value());
+        return key;
+    }
+
+protected:
+    // Pushes a value that is not part of the data, such as a list element produced on demand
+    void pushValue(boost::json::value value)
+    {
+        auto owned = std::make_unique<boost::json::value>(std::move(value));
+        Frame &frame = m_contextStack.emplace_back(owned.get());
+        frame.owned = std::move(owned);
+        frame.transient = true;
+        m_paths.emplace_back();
+    }
+
+private:
+    static bool isFalseValue(const boost::json::value *value)
+    {
+        if (!value || value->is_null()) {
+            return true;
+        }
+
+        if (value->is_bool()) {
+            return !value->as_bool();
+        }
+
+        if (value->is_string()) {
+            const auto &str = value->as_string();
+            return isFalseString(std::string_view(str.data(), str.size()));
+        }
+
+        return false;
+    }
+
+    // Value of key and the index of the frame it was found in, null and the innermost frame if it was not found
+    const boost::json::value *lookup(std::string_view key, size_t hash, size_t &frame) const
+    {
+        frame = m_contextStack.size() - 1;
+        if (key == ".") {
+            countLookup(true);
+            if (dependencies()) {
+                dependencies()->push_back(m_paths.back());
+            }
+            return m_contextStack.back().value;
+        }
+
+        for (size_t i = m_contextStack.size(); i-- > 0;) {
+            if (dependencies()) {
+                dependencies()->push_back(joinPath(m_paths[i], key));
+            }
+            if (const boost::json::value *value = find(m_contextStack[i], key, hash)) {
+                countLookup(true);
+                frame = i;
+                return value;
+            }
+        }
+        countLookup(false);
+        return nullptr;
+    }
+
+    // Paths are only built while dependencies are tracked
+    void pushPath(std::string_view key, size_t frame, int index)
+    {
+        if (!dependencies()) {
+            m_paths.emplace_back();
+            return;
+        }
+        std::string path = key == "." ? m_paths[frame] : joinPath(m_paths[frame], key);
+        if (index >= 0) {
+            path = joinPath(path, std::to_string(index));
+        }
+        m_paths.push_back(std::move(path));
+    }
+
+    // Kind, then the payload, with strings and containers length prefixed
+    static void encodeValue(std::string &out, const boost::json::value &value)
+    {
+        out.push_back(static_cast<char>(value.kind()));
+        switch (value.kind()) {
+        case boost::json::kind::bool_:
+            out.push_back(value.as_bool() ? 1 : 0);
+            return;
+        case boost::json::kind::int64:
+            encodeSize(out, static_cast<uint64_t>(value.as_int64()));
+            return;
+        case boost::json::kind::uint64:
+            encodeSize(out, value.as_uint64());
+            return;
+        case boost::json::kind::double_: {
+            uint64_t bits;
+            const double number = value.as_double();
+            std::memcpy(&bits, &number, sizeof(bits));
+            encodeSize(out, bits);
+            return;
+        }
+        case boost::json::kind::string:
+            encodeString(out, value.as_string());
+            return;
+        case boost::json::kind::array:
+            encodeSize(out, value.as_array().size());
+            for (const auto &element : value.as_array()) {
+                encodeValue(out, element);
+            }
+            return;
+        case boost::json::kind::object:
+            encodeSize(out, value.as_object().size());
+            for (const auto &member : value.as_object()) {
+                encodeString(out, member.key());
+                encodeValue(out, member.value());
+            }
+            return;
+        default:
+            return;
+        }
+    }
+
+    // Positions of an object's members by key hash, open addressed. Built for objects that Boost.JSON scans
+    // linearly and that are looked into repeatedly, so that their lookups reuse the hash the tag carries.
+    class KeyIndex {
+    public:
+        explicit KeyIndex(const boost::json::object &obj)
+        {
+            size_t capacity = 16;
+            while (capacity < obj.size() * 2) {
+                capacity <<= 1;
+            }
+            m_mask = capacity - 1;
+            m_slots.resize(capacity);
+
+            uint32_t position = 0;
+            for (const auto &member : obj) {
+                const size_t hash = keyHash(std::string_view(member.key().data(), member.key().size()));
+                size_t slot = hash & m_mask;
+                while (m_slots[slot].position != empty) {
+                    slot = (slot + 1) & m_mask;
+                }
+                m_slots[slot] = {position++, static_cast<uint32_t>(static_cast<uint64_t>(hash) >> 32)};
+            }
+        }
+
+        const boost::json::value *find(const boost::json::object &obj, std::string_view key, size_t hash) const
+        {
+            const auto tag = static_cast<uint32_t>(static_cast<uint64_t>(hash) >> 32);
+            for (size_t slot = hash & m_mask; m_slots[slot].position != empty; slot = (slot + 1) & m_mask) {
+                if (m_slots[slot].tag != tag) {
+                    continue;
+                }
+                const auto &member = *(obj.begin() + m_slots[slot].position);
+                if (std::string_view(member.key().data(), member.key().size()) == key) {
+                    return &member.value();
+                }
+            }
+            return nullptr;
+        }
+
+    private:
+        static constexpr uint32_t empty = uint32_t(-1);
+
+        struct Slot {
+            uint32_t position{empty};
+            uint32_t tag{0}; // high hash bits, compared before the key
+        };
+
+        std::vector<Slot> m_slots;
+        size_t m_mask{0};
+    };
+
+    struct Frame {
+        explicit Frame(const boost::json::value *frameValue) : value(frameValue) {}
+
+        const boost::json::value *value; // null for missing data
+        std::unique_ptr<boost::json::value> owned; // values that are not part of the data
+        bool transient{false};                     // within a value that is freed when its frame is popped
+        mutable uint32_t probes{0};                // lookups into the value, until it gets an index
+        mutable std::shared_ptr<const KeyIndex> index;
+    };
+
+    // Objects up to this size are searched directly
+    static constexpr size_t smallObject = 8;
+    // Boost.JSON keeps its own hash index for objects of a larger capacity
+    static constexpr size_t indexedObject = 18;
+    // Lookups into a frame before its object is indexed, most list elements are only looked into a few times
+    static constexpr uint32_t indexAfter = 4;
+    // Indexes kept once their frames are popped, least recently used first to go
+    static constexpr size_t cachedIndexes = 64;
+
+    // A frame holds on to its object's index until it is popped. Indexes are also kept by object in a small
+    // cache, so an object pushed again for every element of an enclosing list is indexed once. Transient values
+    // are not indexed, their addresses may be reused.
+    const boost::json::value *find(const Frame &frame, std::string_view key, size_t hash) const
+    {
+        const boost::json::object *obj = frame.value ? frame.value->if_object() : nullptr;
+        if (!obj) {
+            return nullptr;
+        }
+        if (frame.index) {
+            return frame.index->find(*obj, key, hash);
+        }
+        if (obj->size() > smallObject && obj->capacity() <= indexedObject && !frame.transient
+                && ++frame.probes > indexAfter) {
+            frame.index = index(*obj);
+            return frame.index->find(*obj, key, hash);
+        }
+        auto it = obj->find(boost::json::string_view(key.data(), key.size()));
+        return it != obj->end() ? &it->value() : nullptr;
+    }
+
+    std::shared_ptr<const KeyIndex> index(const boost::json::object &obj) const
+    {
+        if (auto it = m_indexes.find(&obj); it != m_indexes.end()) {
+            m_indexOrder.splice(m_indexOrder.begin(), m_indexOrder, it->second);
+            return it->second->second;
+        }
+        if (m_indexes.size() == cachedIndexes) {
+            m_indexes.erase(m_indexOrder.back().first);
+            m_indexOrder.pop_back();
+        }
+        m_indexOrder.emplace_front(&obj, std::make_shared<const KeyIndex>(obj));
+        m_indexes.emplace(&obj, m_indexOrder.begin());
+        return m_indexOrder.front().second;
+    }
+
+    std::unique_ptr<boost::json::value> m_root; // copy rendered by the copying constructor
+    std::vector<Frame> m_contextStack;
+    std::vector<std::string> m_paths; // data path of each frame
+    // Most recently used first
+    mutable std::list<std::pair<const boost::json::object *, std::shared_ptr<const KeyIndex>>> m_indexOrder;
+    mutable std::unordered_map<const boost::json::object *, decltype(m_indexOrder)::iterator> m_indexes;
+};
+
+// JSON context whose lists can also come from generators, for sequences that are too long to materialize or
+// whose length is unknown up front, such as database cursors. A generator returns the next element, or nothing
+// at the end of the list. Elements render as they are produced and only the current one is kept, so memory
+// stays constant when rendering into a streaming sink. A generator is consumed once: later sections over its
+// key render as an empty list. Generator keys take precedence over the data at every level.
+class GeneratorContext : public JsonContext {
+public:
+    using Generator = std::function<std::optional<boost::json::value>()>;
+
+    explicit GeneratorContext(const boost::json::value &root = boost::json::object(),
+            std::shared_ptr<PartialResolver> resolver = nullptr)
+        : JsonContext(root, std::move(resolver))
+    {
+    }
+
+    void setGenerator(std::string key, Generator generator) { m_sources[std::move(key)] = {std::move(generator), {}, false}; }
+
+    // Requests the first element of a generator, which is kept for its section
+    bool isFalse(std::string_view key) const override { return isFalse(HashedKey{key, keyHash(key)}); }
+
+    bool isFalse(const HashedKey &key) const override
+    {
+        if (Source *source = find(key.key)) {
+            return !peek(*source);
+        }
+        return JsonContext::isFalse(key);
+    }
+
+    // Generator keys resolve to no data, their sections iterate through next
+    ResolvedKey resolve(std::string_view key) const override { return resolve(HashedKey{key, keyHash(key)}); }
+
+    ResolvedKey resolve(const HashedKey &key) const override
+    {
+        return find(key.key) ? ResolvedKey{key.key} : JsonContext::resolve(key);
+    }
+
+    bool resolvedFalse(const ResolvedKey &resolved) const override
+    {
+        if (Source *source = find(resolved.key)) {
+            return !peek(*source);
+        }
+        return JsonContext::resolvedFalse(resolved);
+    }
+
+    bool iterable(std::string_view key) const override { return find(key) != nullptr; }
+
+    bool next(std::string_view key) override
+    {
+        Source *source = find(key);
+        if (!source || !peek(*source)) {
+            return false;
+        }
+        pushValue(std::move(*source->pending));
+        source->pending.reset();
+        return true;
+    }
+
+    // Generated elements have no data path
+    bool supportsDependencies() const override { return false; }
+
+private:
+    struct Source {
+        Generator generator;
+        std::optional<boost::json::value> pending; // requested but not rendered yet
+        bool done{false};
+    };
+
+    Source *find(std::string_view key) const
+    {
+        auto it = m_sources.find(key);
+        return it != m_sources.end() ? &it->second : nullptr;
+    }
+
+    static bool peek(Source &source)
+    {
+        if (!source.pending && !source.done) {
+            source.pending = source.generator();
+            source.done = !source.pending;
+        }
+        return source.pending.has_value();
+    }
+
+    mutable std::map<std::string, Source, std::less<>> m_sources;
+};
+
+// Copies the parts of data a template can look up into a compact document rendering the same output.
+// Lookups are replayed the way JsonContext resolves them, through every list element and, when given a
+// resolver, through partials. Lists keep their length, elements no lookup reaches become null.
+inline boost::json::value project(const Template &templ, const boost::json::value &data, PartialResolver *resolver = nullptr)
+{
+    // Parts of the source to keep, either whole or only the members and elements below
+    struct Selection {
+        bool whole{false};
+        std::map<std::string, Selection, std::less<>> members;
+        std::map<size_t, Selection> elements;
+    };
+
+    struct Frame {
+        const boost::json::value *value;
+        Selection *selection;
+    };
+
+    Selection root;
+    std::vector<Frame> frames{{&data, &root}};
+    std::map<std::string, std::unique_ptr<Template>, std::less<>> partials;
+    std::vector<std::pair<std::string_view, size_t>> partialStack;
+
+    auto find = [&frames](std::string_view key) -> std::optional<Frame> {
+        if (key == ".") {
+            return frames.back();
+        }
+        for (size_t i = frames.size(); i-- > 0;) {
+            if (const auto *object = frames[i].value->if_object()) {
+                if (const auto *member = object->if_contains(key)) {
+                    auto it = frames[i].selection->members.try_emplace(std::string(key)).first;
+                    return Frame{member, &it->second};
+                }
+            }
+        }
+        return std::nullopt;
+    };
+
+    std::function<void(const std::vector<Node> &)> walk;
+    walk = [&](const std::vector<Node> &nodes) {
+        for (const auto &node : nodes) {
+            const Tag &tag = node.tag;
+            switch (tag.type) {
+            case Tag::type::Value:
+                if (auto found = find(tag.key)) {
+                    found->selection->whole = true;
+                }
+                break;
+
+            case Tag::type::SectionStart: {
+                auto found = find(tag.key);
+                const auto *list = found ? found->value->if_array() : nullptr;
+                if (list && !list->empty()) {
+                    for (size_t i = 0; i < list->size(); ++i) {
+                        frames.push_back({&(*list)[i], &found->selection->elements[i]});
+                        walk(node.children);
+                        frames.pop_back();
+                    }
+                }
+                else if (!found || FunctionRegistry::instance().find(tag.key, &node.function)) {
+                    walk(node.children);
+                }
+                else {
+                    if (!found->value->is_object() && !found->value->is_array()) {
+                        found->selection->whole = true;
+                    }
+                    frames.push_back(*found);
+                    walk(node.children);
+                    frames.pop_back();
+                }
+                break;
+            }
+
+            case Tag::type::InvertedSectionStart:
+                if (auto found = find(tag.key); found && !found->value->is_object() && !found->value->is_array()) {
+                    found->selection->whole = true;
+                }
+                walk(node.children);
+                break;
+
+            case Tag::type::Partial: {
+                if (!resolver) {
+                    break;
+                }
+                // A partial including itself without entering data would never end
+                const std::pair<std::string_view, size_t> entry{tag.key, frames.size()};
+                if (std::find(partialStack.begin(), partialStack.end(), entry) != partialStack.end()) {
+                    break;
+                }
+                auto it = partials.find(tag.key);
+                if (it == partials.end()) {
+                    it = partials.emplace(tag.key, std::make_unique<Template>(resolver->getPartial(tag.key))).first;
+                }
+                partialStack.push_back(entry);
+                walk(it->second->nodes());
+                partialStack.pop_back();
+                break;
+            }
+
+            default:
+                break;
+            }
+        }
+    };
+    walk(templ.nodes());
+
+    std::function<boost::json::value(const boost::json::value &, const Selection &)> build;
+    build = [&build](const boost::json::value &value, const Selection &selection) -> boost::json::value {
+        if (selection.whole) {
+            return value;
+        }
+        if (const auto *object = value.if_object()) {
+            boost::json::object result;
+            result.reserve(selection.members.size());
+            for (const auto &[key, member] : selection.members) {
+                result.emplace(key, build(object->find(key)->value(), member));
+            }
+            return result;
+        }
+        if (const auto *list = value.if_array()) {
+            boost::json::array result(list->size());
+            for (const auto &[index, element] : selection.elements) {
+                result[index] = build((*list)[index], element);
+            }
+            return result;
+        }
+        return value;
+    };
+    return build(data, root);
+}
+
+inline std::string render(std::string_view templateString, const boost::property_tree::ptree &args)
+{
+    PropertyTreeContext context(args);
+    Renderer renderer;
+    return renderer.render(templateString, &context);
+}
+
+inline std::string render(std::string_view templateString, const boost::json::value &args)
+{
+    JsonContext context(&args);
+    Renderer renderer;
+    return renderer.render(templateString, &context);
+}
+
+inline std::string render(const Template &compiledTemplate, const boost::property_tree::ptree &args, size_t sizeHint = 0)
+{
+    PropertyTreeContext context(args);
+    Renderer renderer;
+    return renderer.render(compiledTemplate, &context, sizeHint);
+}
+
+inline std::string render(const Template &compiledTemplate, const boost::json::value &args, size_t sizeHint = 0)
+{
+    JsonContext context(&args);
+    Renderer renderer;
+    return renderer.render(compiledTemplate, &context, sizeHint);
 }
 } // namespace boost::mustache
\ No newline at end of file
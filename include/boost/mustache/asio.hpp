@@ -0,0 +1,168 @@
+#pragma once
+#include <boost/mustache.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/compose.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/system/error_code.hpp>
+#include <atomic>
+#include <memory>
+
+namespace boost::mustache {
+// Composed operation behind asyncRender(). Each write is started before the idle buffer is rendered into, so the
+// stream drains one buffer while the next chunk is rendered into the other. The next write starts once both are
+// done, from the write's completion if rendering finished first and otherwise from a post by the rendering side.
+template<class AsyncWriteStream>
+class AsyncRenderOperation {
+public:
+    AsyncRenderOperation(AsyncWriteStream &stream, const Template &templ, Context *context, std::size_t bufferSize)
+        : m_stream(stream), m_state(std::make_unique<State>(templ, context, bufferSize))
+    {
+    }
+
+    template<class Self>
+    void operator()(Self &self, boost::system::error_code ec = {}, std::size_t bytesWritten = 0)
+    {
+        State &state = *m_state;
+        if (!state.started) {
+            // Even an empty first chunk is written, so that completion never happens inside the initiating call
+            state.started = true;
+            state.fill(0);
+            write(self, 0);
+            return;
+        }
+        if (state.resumed) {
+            // The write's result is already in the state
+            state.resumed = false;
+            next(self);
+            return;
+        }
+
+        state.total += bytesWritten;
+        state.ec = ec;
+        if (state.flags.fetch_or(State::writeDone, std::memory_order_acq_rel) & State::fillDone) {
+            next(self);
+            return;
+        }
+
+        // Still rendering: park the operation for the rendering side to resume, unless it finished meanwhile
+        state.parked = std::make_unique<Parked<Self>>(std::move(self));
+        if (state.flags.fetch_or(State::operationParked, std::memory_order_acq_rel) & State::fillDone) {
+            Self resumed = unpark<Self>(state);
+            state.resumed = true;
+            resumed();
+        }
+    }
+
+private:
+    struct ParkedBase {
+        virtual ~ParkedBase() = default;
+    };
+
+    template<class Self>
+    struct Parked : ParkedBase {
+        explicit Parked(Self &&self) : self(std::move(self)) {}
+        Self self;
+    };
+
+    struct State {
+        // Bits of flags, cleared before each write
+        static constexpr unsigned writeDone = 1;
+        static constexpr unsigned operationParked = 2;
+        static constexpr unsigned fillDone = 4;
+
+        State(const Template &templ, Context *context, std::size_t bufferSize)
+            : stream(templ, context), bufferSize(bufferSize)
+        {
+            buffers[0] = std::make_unique<char[]>(bufferSize);
+            buffers[1] = std::make_unique<char[]>(bufferSize);
+        }
+
+        void fill(std::size_t index) { sizes[index] = stream.nextChunk(buffers[index].get(), bufferSize); }
+
+        boost::system::error_code error() const
+        {
+            if (stream.renderer().errorPos()) {
+                return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+            }
+            return {};
+        }
+
+        RenderStream stream;
+        std::size_t bufferSize;
+        std::unique_ptr<char[]> buffers[2];
+        std::size_t sizes[2]{0, 0};
+        std::size_t current{0};
+        std::size_t total{0};
+        boost::system::error_code ec;
+        std::atomic<unsigned> flags{0};
+        // The operation while its write has completed and the idle buffer is still being rendered into
+        std::unique_ptr<ParkedBase> parked;
+        bool started{false};
+        bool resumed{false};
+    };
+
+    template<class Self>
+    static Self unpark(State &state)
+    {
+        const std::unique_ptr<ParkedBase> parked = std::move(state.parked);
+        return std::move(static_cast<Parked<Self> &>(*parked).self);
+    }
+
+    template<class Self>
+    void next(Self &self)
+    {
+        State &state = *m_state;
+        if (state.ec) {
+            self.complete(state.ec, state.total);
+            return;
+        }
+        const std::size_t index = 1 - state.current;
+        if (state.sizes[index] == 0) {
+            self.complete(state.error(), state.total);
+            return;
+        }
+        write(self, index);
+    }
+
+    // Once self is moved into the write, its completion may run on another thread of the io_context at any time,
+    // so the idle buffer is rendered into through the state alone and the flags decide who goes on
+    template<class Self>
+    void write(Self &self, std::size_t index)
+    {
+        State *state = m_state.get();
+        state->current = index;
+        state->flags.store(0, std::memory_order_relaxed);
+        const auto buffer = boost::asio::buffer(state->buffers[index].get(), state->sizes[index]);
+        boost::asio::async_write(m_stream, buffer, std::move(self));
+
+        state->fill(1 - index);
+        if (state->flags.fetch_or(State::fillDone, std::memory_order_acq_rel) & State::operationParked) {
+            Self resumed = unpark<Self>(*state);
+            state->resumed = true;
+            boost::asio::post(std::move(resumed));
+        }
+    }
+    AsyncWriteStream &m_stream;
+    std::unique_ptr<State> m_state;
+};
+
+// Renders a compiled template to an Asio stream, writing chunks of at most bufferSize bytes as they are rendered.
+// Completes with (error_code, bytes written); render errors are reported as errc::invalid_argument.
+// The stream, template and context must outlive the operation.
+template<class AsyncWriteStream, class CompletionToken>
+auto asyncRender(AsyncWriteStream &stream, const Template &templ, Context *context, std::size_t bufferSize,
+        CompletionToken &&token)
+{
+    // async_compose takes the token by lvalue reference and moves the handler out of it, move-only ones included
+    return boost::asio::async_compose<CompletionToken, void(boost::system::error_code, std::size_t)>(
+            AsyncRenderOperation<AsyncWriteStream>(stream, templ, context, bufferSize), token, stream);
+}
+
+template<class AsyncWriteStream, class CompletionToken>
+auto asyncRender(AsyncWriteStream &stream, const Template &templ, Context *context, CompletionToken &&token)
+{
+    return asyncRender(stream, templ, context, 16 * 1024, std::forward<CompletionToken>(token));
+}
+} // namespace boost::mustache
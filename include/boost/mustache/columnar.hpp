@@ -0,0 +1,294 @@
+#pragma once
+#include <boost/mustache.hpp>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <stdexcept>
+#include <variant>
+#include <vector>
+
+namespace boost::mustache {
+// Context over tabular data stored by column. Each table renders as a list section named after it, one
+// iteration per row. A section records the columns its first row looked up, in order, and the following rows
+// take them from the record, only comparing the key. Top-level values sit beside the tables and are visible
+// from every row.
+class ColumnarContext : public Context {
+public:
+    using Column = std::variant<std::vector<std::string>, std::vector<int64_t>, std::vector<double>, std::vector<bool>>;
+    using Value = std::variant<std::string, int64_t, double, bool>;
+
+    explicit ColumnarContext(std::shared_ptr<PartialResolver> resolver = nullptr) : Context(std::move(resolver))
+    {
+        m_contextStack.emplace_back();
+    }
+
+    // All columns of a table must have the same number of rows
+    void addTable(std::string key, std::map<std::string, Column, std::less<>> columns)
+    {
+        Table table;
+        bool first = true;
+        for (const auto &[name, column] : columns) {
+            const size_t rows = std::visit([](const auto &values) { return values.size(); }, column);
+            if (!first && rows != table.rows) {
+                throw std::invalid_argument("boost::mustache: columns of different lengths");
+            }
+            table.rows = rows;
+            first = false;
+        }
+        table.columns = std::move(columns);
+        m_tables[std::move(key)] = std::move(table);
+    }
+
+    void setValue(std::string key, Value value) { m_values[std::move(key)] = std::move(value); }
+    void setValue(std::string key, const char *value) { m_values[std::move(key)] = std::string(value); }
+
+    bool isFalse(std::string_view key) const override { return isFalse(find(key)); }
+
+    std::string stringValue(std::string_view key) const override
+    {
+        const Field field = find(key);
+        if (field.column) {
+            return std::visit([&field](const auto &values) { return toString(values[field.row]); }, *field.column);
+        }
+        if (field.value) {
+            return std::visit([](const auto &value) { return toString(value); }, *field.value);
+        }
+        return {};
+    }
+
+    std::optional<ValueView> typedValue(std::string_view key) const override
+    {
+        const Field field = find(key);
+        if (field.column) {
+            return std::visit([&field](const auto &values) { return view(values[field.row]); }, *field.column);
+        }
+        if (field.value) {
+            return std::visit([](const auto &value) { return view(value); }, *field.value);
+        }
+        return ValueView{};
+    }
+
+    size_t listCount(std::string_view key) const override { return resolvedCount(resolve(key)); }
+
+    void push(std::string_view key, int index = -1) override { pushResolved(resolve(key), index); }
+
+    // Sections are kept per depth, as a section is pushed before anything else is resolved at its depth. The
+    // columns recorded for a table are kept while the same table is resolved again.
+    ResolvedKey resolve(std::string_view key) const override
+    {
+        const size_t depth = m_contextStack.size();
+        if (m_sections.size() < depth) {
+            m_sections.resize(depth);
+        }
+        Section &section = m_sections[depth - 1];
+        const Field field = find(key);
+        if (field.table != section.field.table) {
+            section.lookups.clear();
+        }
+        section.field = field;
+        return {key, &section};
+    }
+
+    size_t resolvedCount(const ResolvedKey &resolved) const override
+    {
+        const Field &field = static_cast<const Section *>(resolved.value)->field;
+        return field.table && !field.column && field.row == npos ? field.table->rows : 0;
+    }
+
+    bool resolvedFalse(const ResolvedKey &resolved) const override
+    {
+        return isFalse(static_cast<const Section *>(resolved.value)->field);
+    }
+
+    void pushResolved(const ResolvedKey &resolved, int index = -1) override
+    {
+        auto &section = *const_cast<Section *>(static_cast<const Section *>(resolved.value));
+        Field field = section.field;
+        if (field.table && !field.column && field.row == npos && index >= 0) {
+            field.row = static_cast<size_t>(index) < field.table->rows ? static_cast<size_t>(index) : npos;
+            if (field.row == npos) {
+                field = {};
+            }
+        }
+        if (field.isRow()) {
+            field.section = &section;
+            section.next = 0;
+        }
+        m_contextStack.push_back(field);
+    }
+
+    void pop() override
+    {
+        if (m_contextStack.size() > 1) {
+            m_contextStack.pop_back();
+        }
+    }
+
+private:
+    static constexpr size_t npos = size_t(-1);
+
+    struct Table {
+        size_t rows{0};
+        std::map<std::string, Column, std::less<>> columns;
+    };
+
+    struct Section;
+
+    // A table, one of its rows, a cell or a top-level value, all null when missing. Frames are fields too
+    // and only rows are looked into.
+    struct Field {
+        const Table *table{nullptr};
+        const Column *column{nullptr};
+        size_t row{npos};
+        const Value *value{nullptr};
+        Section *section{nullptr}; // of a row, the section it was pushed by
+
+        bool isRow() const { return table && !column && row != npos; }
+    };
+
+    // Column a key looked up in a row resolved to, null if the table has none
+    struct Lookup {
+        std::string key;
+        const Column *column;
+    };
+
+    // A section's field, and for tables the lookups into its rows in the order of the first row. Rows that
+    // look up something else replace the lookups from there on.
+    struct Section {
+        Field field;
+        std::vector<Lookup> lookups;
+        size_t next{0};
+    };
+
+    // Lookups recorded per section, a body looking up more takes the rest from the table
+    static constexpr size_t recordedLookups = 256;
+
+    static const Column *column(const Table &table, std::string_view key)
+    {
+        auto it = table.columns.find(key);
+        return it != table.columns.end() ? &it->second : nullptr;
+    }
+
+    static const Column *column(const Field &row, std::string_view key)
+    {
+        Section *section = row.section;
+        if (!section || section->next == recordedLookups) {
+            return column(*row.table, key);
+        }
+        if (section->next < section->lookups.size()) {
+            Lookup &lookup = section->lookups[section->next++];
+            if (lookup.key != key) {
+                lookup = {std::string(key), column(*row.table, key)};
+            }
+            return lookup.column;
+        }
+        ++section->next;
+        return section->lookups.emplace_back(Lookup{std::string(key), column(*row.table, key)}).column;
+    }
+
+    Field find(std::string_view key) const
+    {
+        if (key == ".") {
+            countLookup(true);
+            return m_contextStack.back();
+        }
+
+        for (auto it = m_contextStack.rbegin(); it != m_contextStack.rend(); ++it) {
+            if (!it->isRow()) {
+                continue;
+            }
+            if (const Column *found = column(*it, key)) {
+                countLookup(true);
+                return {it->table, found, it->row};
+            }
+        }
+
+        if (auto it = m_values.find(key); it != m_values.end()) {
+            countLookup(true);
+            return {nullptr, nullptr, npos, &it->second};
+        }
+        if (auto it = m_tables.find(key); it != m_tables.end()) {
+            countLookup(true);
+            return {&it->second};
+        }
+        countLookup(false);
+        return {};
+    }
+
+    static bool isFalse(const Field &field)
+    {
+        if (field.column) {
+            return std::visit([&field](const auto &values) { return isFalse(values[field.row]); }, *field.column);
+        }
+        if (field.value) {
+            return std::visit([](const auto &value) { return isFalse(value); }, *field.value);
+        }
+        if (field.table && field.row == npos) {
+            return field.table->rows == 0;
+        }
+        return !field.table;
+    }
+
+    static bool isFalse(bool value) { return !value; }
+    static bool isFalse(int64_t) { return false; }
+    static bool isFalse(double) { return false; }
+
+    static bool isFalse(const std::string &value) { return isFalseString(value); }
+
+    static ValueView view(bool value)
+    {
+        ValueView result;
+        result.type = ValueView::type::Bool;
+        result.boolean = value;
+        return result;
+    }
+
+    static ValueView view(int64_t value)
+    {
+        ValueView result;
+        result.type = ValueView::type::Int;
+        result.integer = value;
+        return result;
+    }
+
+    static ValueView view(double value)
+    {
+        ValueView result;
+        result.type = ValueView::type::Double;
+        result.real = value;
+        return result;
+    }
+
+    static ValueView view(const std::string &value)
+    {
+        ValueView result;
+        result.type = ValueView::type::String;
+        result.string = value;
+        return result;
+    }
+
+    static std::string toString(bool value) { return value ? "true" : "false"; }
+    static std::string toString(int64_t value) { return std::to_string(value); }
+    static std::string toString(const std::string &value) { return value; }
+
+    static std::string toString(double value)
+    {
+        std::ostringstream oss;
+        oss.precision(6);
+
+        if (std::floor(value) == value) {
+            oss << std::fixed << std::setprecision(0) << value;
+        }
+        else {
+            oss << std::defaultfloat << value;
+        }
+        return oss.str();
+    }
+
+    std::map<std::string, Table, std::less<>> m_tables;
+    std::map<std::string, Value, std::less<>> m_values;
+    std::vector<Field> m_contextStack;
+    // Deque so that rows keep pointing at their section as deeper ones are added
+    mutable std::deque<Section> m_sections;
+};
+} // namespace boost::mustache
@@ -0,0 +1,451 @@
+#pragma once
+#include <boost/mustache.hpp>
+#include <boost/json/basic_parser_impl.hpp>
+#include <boost/system/error_code.hpp>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace boost::mustache {
+// Renders a compiled template from JSON text fed in chunks, without building the whole document first.
+//
+// Members of the root object are kept as they arrive, and top-level template nodes render in order as soon as
+// every root member they may look up has arrived, as found by analyzing the node's whole subtree, partials and
+// function bodies included. A key counts as arrived when the enclosing section data provides it, in every
+// element of the lists on the way, or when the root has it. A top-level list section whose list arrives once
+// everything before it is rendered is streamed when no other node uses its key: each element is parsed,
+// rendered and dropped as long as it is ready, so memory is bounded by the members preceding the list plus the
+// largest element. From the first element that is not ready on, the rest of the list is kept and renders once
+// ready. Output is the same as rendering the whole document, unless the root repeats a key: a node renders with
+// the member present when it is ready, where parsing the whole document keeps the last one. Top-level functions,
+// nodes whose partials cannot be resolved and nodes looking up members the document lacks render at the end of
+// the document, as does everything for a non-object root.
+//
+// The template and the sink must outlive the renderer.
+class JsonStreamRenderer {
+public:
+    JsonStreamRenderer(const Template &templ, OutputSink &sink, std::shared_ptr<PartialResolver> resolver = nullptr)
+        : m_templ(templ), m_sink(sink), m_resolver(std::move(resolver)), m_parser(boost::json::parse_options{}, this)
+    {
+        plan();
+        m_stack.reset();
+    }
+
+    JsonStreamRenderer(const JsonStreamRenderer &) = delete;
+    JsonStreamRenderer &operator=(const JsonStreamRenderer &) = delete;
+
+    // Parses the next chunk and renders what it completes. Fails on malformed JSON or a render error,
+    // the latter reported as errc::invalid_argument with the details in renderer().
+    bool write(std::string_view data, boost::system::error_code &ec)
+    {
+        const std::size_t consumed = m_parser.write_some(true, data.data(), data.size(), ec);
+        if (!ec && consumed < data.size()) {
+            ec = boost::json::error::extra_data;
+        }
+        return !ec;
+    }
+
+    // Ends the document and renders the remaining nodes
+    bool finish(boost::system::error_code &ec)
+    {
+        m_parser.write_some(false, nullptr, 0, ec);
+        if (ec) {
+            return false;
+        }
+        if (!advance(true)) {
+            ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+        }
+        return !ec;
+    }
+
+    const Renderer &renderer() const { return m_renderer; }
+
+    // List elements rendered as they arrived
+    std::size_t streamedElements() const { return m_streamedElements; }
+
+private:
+    class Handler {
+    public:
+        static constexpr std::size_t max_object_size = std::size_t(-1);
+        static constexpr std::size_t max_array_size = std::size_t(-1);
+        static constexpr std::size_t max_key_size = std::size_t(-1);
+        static constexpr std::size_t max_string_size = std::size_t(-1);
+
+        explicit Handler(JsonStreamRenderer *owner) : m_owner(owner) {}
+
+        bool on_document_begin(boost::system::error_code &) { return true; }
+        bool on_document_end(boost::system::error_code &) { return true; }
+
+        bool on_object_begin(boost::system::error_code &)
+        {
+            if (m_owner->m_depth++ == 0) {
+                m_owner->m_rootObject = true;
+                m_owner->m_document = boost::json::object();
+            }
+            return true;
+        }
+
+        bool on_object_end(std::size_t n, boost::system::error_code &ec)
+        {
+            if (--m_owner->m_depth == 0 && m_owner->m_rootObject) {
+                return true;
+            }
+            m_owner->m_stack.push_object(n);
+            return m_owner->completed(ec);
+        }
+
+        bool on_array_begin(boost::system::error_code &)
+        {
+            if (m_owner->m_depth++ == 1 && m_owner->m_rootObject && m_owner->canStream()) {
+                m_owner->m_streaming = true;
+                m_owner->m_elements = 0;
+                m_owner->m_buffered = 0;
+            }
+            return true;
+        }
+
+        bool on_array_end(std::size_t n, boost::system::error_code &ec)
+        {
+            if (--m_owner->m_depth == 1 && m_owner->m_streaming) {
+                return m_owner->endStream(ec);
+            }
+            m_owner->m_stack.push_array(n);
+            return m_owner->completed(ec);
+        }
+
+        bool on_key_part(boost::json::string_view s, std::size_t, boost::system::error_code &)
+        {
+            if (m_owner->atRoot()) {
+                m_owner->m_key.append(s.data(), s.size());
+            }
+            else {
+                m_owner->m_stack.push_chars(s);
+            }
+            return true;
+        }
+
+        bool on_key(boost::json::string_view s, std::size_t, boost::system::error_code &)
+        {
+            if (m_owner->atRoot()) {
+                m_owner->m_key.append(s.data(), s.size());
+            }
+            else {
+                m_owner->m_stack.push_key(s);
+            }
+            return true;
+        }
+
+        bool on_string_part(boost::json::string_view s, std::size_t, boost::system::error_code &)
+        {
+            m_owner->m_stack.push_chars(s);
+            return true;
+        }
+
+        bool on_string(boost::json::string_view s, std::size_t, boost::system::error_code &ec)
+        {
+            m_owner->m_stack.push_string(s);
+            return m_owner->completed(ec);
+        }
+
+        bool on_number_part(boost::json::string_view, boost::system::error_code &) { return true; }
+
+        bool on_int64(std::int64_t i, boost::json::string_view, boost::system::error_code &ec)
+        {
+            m_owner->m_stack.push_int64(i);
+            return m_owner->completed(ec);
+        }
+
+        bool on_uint64(std::uint64_t u, boost::json::string_view, boost::system::error_code &ec)
+        {
+            m_owner->m_stack.push_uint64(u);
+            return m_owner->completed(ec);
+        }
+
+        bool on_double(double d, boost::json::string_view, boost::system::error_code &ec)
+        {
+            m_owner->m_stack.push_double(d);
+            return m_owner->completed(ec);
+        }
+
+        bool on_bool(bool b, boost::system::error_code &ec)
+        {
+            m_owner->m_stack.push_bool(b);
+            return m_owner->completed(ec);
+        }
+
+        bool on_null(boost::system::error_code &ec)
+        {
+            m_owner->m_stack.push_null();
+            return m_owner->completed(ec);
+        }
+
+        bool on_comment_part(boost::json::string_view, boost::system::error_code &) { return true; }
+        bool on_comment(boost::json::string_view, boost::system::error_code &) { return true; }
+
+    private:
+        JsonStreamRenderer *m_owner;
+    };
+
+    // What a top-level node may look up, from the analysis of its subtree
+    struct Plan {
+        std::vector<std::vector<std::string>> paths; // key and section paths split into their keys
+        bool deferred{false};                         // rendered at the end of the document
+        bool opaque{false};                           // may look up any root member
+        bool streamable{false};
+    };
+
+    void plan()
+    {
+        const auto &nodes = m_templ.nodes();
+        m_plans.resize(nodes.size());
+        for (std::size_t index = 0; index < nodes.size(); ++index) {
+            const Node &node = nodes[index];
+            Plan &plan = m_plans[index];
+            if (node.tag.type == Tag::type::Null) {
+                continue;
+            }
+            if (node.tag.type == Tag::type::SectionStart && isFunction(node)) {
+                plan.deferred = plan.opaque = true;
+                continue;
+            }
+            const TemplateAnalysis analysis = analyze(&node, &node + 1, m_resolver.get());
+            // Partials left unwalked may look up anything, invalid ones report their error at the end
+            if ((!m_resolver && !analysis.partials.empty()) || !analysis.invalidPartials.empty()) {
+                plan.deferred = plan.opaque = true;
+                continue;
+            }
+            for (const auto &path : analysis.keys) {
+                addPath(plan, path);
+            }
+            for (const auto &[path, usage] : analysis.sections) {
+                addPath(plan, path);
+            }
+        }
+
+        // Streamed elements are dropped, so nothing else may see the list, including the node's own body
+        for (std::size_t index = 0; index < nodes.size(); ++index) {
+            const Node &node = nodes[index];
+            Plan &plan = m_plans[index];
+            if (node.tag.type != Tag::type::SectionStart || plan.deferred) {
+                continue;
+            }
+            plan.streamable = true;
+            for (std::size_t other = 0; other < nodes.size() && plan.streamable; ++other) {
+                if (m_plans[other].opaque) {
+                    plan.streamable = false;
+                    break;
+                }
+                for (const auto &path : m_plans[other].paths) {
+                    const auto first = path.begin() + (other == index ? 1 : 0);
+                    if (std::find(first, path.end(), node.tag.key) != path.end()) {
+                        plan.streamable = false;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    static void addPath(Plan &plan, std::string_view path)
+    {
+        if (path == ".") {
+            // The root itself, which is only complete at the end
+            plan.deferred = plan.opaque = true;
+            return;
+        }
+        std::vector<std::string> keys;
+        std::size_t start = 0;
+        for (std::size_t dot = path.find('.'); dot != std::string_view::npos; dot = path.find('.', start)) {
+            keys.emplace_back(path.substr(start, dot - start));
+            start = dot + 1;
+        }
+        keys.emplace_back(path.substr(start));
+        plan.paths.push_back(std::move(keys));
+    }
+
+    bool isFunction(const Node &node) const
+    {
+        const auto &functions = m_templ.functions();
+        return (functions && functions->find(node.tag.key))
+            || FunctionRegistry::instance().find(node.tag.key, &node.function);
+    }
+
+    bool atRoot() const { return m_depth == 1 && m_rootObject; }
+
+    bool canStream() const
+    {
+        return m_next < m_plans.size() && m_plans[m_next].streamable && m_templ.nodes()[m_next].tag.key == m_key;
+    }
+
+    // A value was pushed, release it if it completes a root member, a streamed element or the document
+    bool completed(boost::system::error_code &ec)
+    {
+        if (!m_rootObject) {
+            if (m_depth == 0) {
+                m_document = m_stack.release();
+                m_stack.reset();
+            }
+            return true;
+        }
+        if (m_streaming && m_depth == 2) {
+            boost::json::value element = m_stack.release();
+            m_stack.reset();
+            auto &root = m_document.as_object();
+            if (m_buffered > 0) {
+                root[m_key].as_array().push_back(std::move(element));
+                ++m_buffered;
+                return true;
+            }
+            root[m_key] = boost::json::array{std::move(element)};
+            if (!ready(m_next)) {
+                // Kept with the rest of the list until what it looks up arrives
+                m_buffered = 1;
+                return true;
+            }
+            ++m_elements;
+            ++m_streamedElements;
+            renderNode(m_next);
+            return succeeded(ec);
+        }
+        if (m_depth == 1) {
+            m_document.as_object()[m_key] = m_stack.release();
+            m_stack.reset();
+            m_key.clear();
+            advance(false);
+            return succeeded(ec);
+        }
+        return true;
+    }
+
+    bool endStream(boost::system::error_code &ec)
+    {
+        m_streaming = false;
+        auto &root = m_document.as_object();
+        if (m_buffered > 0) {
+            // The member holds the elements left to render
+        }
+        else if (m_elements == 0) {
+            // Rendered like any other list, which covers what an empty one renders
+            root[m_key] = boost::json::array();
+        }
+        else {
+            root.erase(m_key);
+            ++m_next;
+        }
+        m_key.clear();
+        advance(false);
+        return succeeded(ec);
+    }
+
+    bool succeeded(boost::system::error_code &ec)
+    {
+        if (m_failed) {
+            ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+        }
+        return !m_failed;
+    }
+
+    bool ready(std::size_t index) const
+    {
+        if (m_templ.nodes()[index].tag.type == Tag::type::Null) {
+            return true;
+        }
+        const Plan &plan = m_plans[index];
+        if (!m_rootObject || plan.deferred) {
+            return false;
+        }
+        std::vector<const boost::json::value *> frames;
+        for (const auto &path : plan.paths) {
+            if (!resolves(path, 0, frames)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // True if the keys of path from index on resolve in the values pushed by the enclosing sections, for every
+    // element of the lists on the way, or else in the root
+    bool resolves(const std::vector<std::string> &path, std::size_t index,
+            std::vector<const boost::json::value *> &frames) const
+    {
+        if (index == path.size()) {
+            return true;
+        }
+        const boost::json::value *value = nullptr;
+        for (auto it = frames.rbegin(); it != frames.rend() && !value; ++it) {
+            if ((*it)->is_object()) {
+                const auto &object = (*it)->as_object();
+                if (auto member = object.find(path[index]); member != object.end()) {
+                    value = &member->value();
+                }
+            }
+        }
+        if (!value) {
+            const auto &root = m_document.as_object();
+            auto member = root.find(path[index]);
+            if (member == root.end()) {
+                return false;
+            }
+            value = &member->value();
+        }
+
+        // Empty lists render their body once, like other values
+        if (!value->is_array() || value->as_array().empty()) {
+            frames.push_back(value);
+            const bool resolved = resolves(path, index + 1, frames);
+            frames.pop_back();
+            return resolved;
+        }
+        for (const auto &element : value->as_array()) {
+            frames.push_back(&element);
+            const bool resolved = resolves(path, index + 1, frames);
+            frames.pop_back();
+            if (!resolved) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Renders the top-level nodes that can be rendered, all remaining ones at the end of the document
+    bool advance(bool end)
+    {
+        const auto &nodes = m_templ.nodes();
+        while (!m_failed && m_next < nodes.size() && (end || ready(m_next))) {
+            renderNode(m_next++);
+        }
+        return !m_failed;
+    }
+
+    void renderNode(std::size_t index)
+    {
+        JsonContext context(&m_document, m_resolver);
+        Renderer::State state;
+        if (m_renderer.begin(state, m_templ, &context, m_sink, 0, index, index + 1)) {
+            m_renderer.run(state, &context, m_sink, false);
+            m_renderer.finish(state, &context);
+        }
+        if (m_renderer.errorPos()) {
+            m_failed = true;
+        }
+    }
+
+    const Template &m_templ;
+    OutputSink &m_sink;
+    std::shared_ptr<PartialResolver> m_resolver;
+    Renderer m_renderer;
+    std::vector<Plan> m_plans;
+    boost::json::value m_document;
+    boost::json::value_stack m_stack;
+    std::string m_key; // root member being parsed
+    std::size_t m_depth{0};
+    std::size_t m_next{0}; // next top-level node to render
+    std::size_t m_elements{0}; // rendered as they arrived
+    std::size_t m_buffered{0}; // kept for later
+    std::size_t m_streamedElements{0};
+    bool m_rootObject{false};
+    bool m_streaming{false};
+    bool m_failed{false};
+    boost::json::basic_parser<Handler> m_parser;
+};
+} // namespace boost::mustache
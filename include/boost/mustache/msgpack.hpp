@@ -0,0 +1,451 @@
+#pragma once
+#include <boost/mustache.hpp>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace boost::mustache {
+// Context reading MessagePack directly from its encoded bytes, without decoding into a DOM. Frames are offsets
+// into the buffer. Small maps are scanned, large or repeatedly looked into ones get a key index that lives as
+// long as their frame, and list elements are stepped to from the previous one. Keys and strings are views into
+// the buffer, which must outlive the context. Malformed or truncated data reads as missing.
+class MsgPackContext : public Context {
+public:
+    static constexpr size_t npos = size_t(-1);
+
+    explicit MsgPackContext(std::string_view buffer, std::shared_ptr<PartialResolver> resolver = nullptr)
+        : Context(std::move(resolver)), m_buffer(buffer)
+    {
+        m_contextStack.emplace_back(buffer.empty() ? npos : 0);
+    }
+
+    // Offset of the value for key, npos if it is missing
+    size_t getValue(std::string_view key) const
+    {
+        if (key == ".") {
+            countLookup(true);
+            return m_contextStack.back().offset;
+        }
+
+        for (auto it = m_contextStack.rbegin(); it != m_contextStack.rend(); ++it) {
+            if (const size_t found = find(*it, key); found != npos) {
+                countLookup(true);
+                return found;
+            }
+        }
+        countLookup(false);
+        return npos;
+    }
+
+    bool isFalse(std::string_view key) const override { return isFalse(header(getValue(key))); }
+
+    std::string stringValue(std::string_view key) const override
+    {
+        const Header value = header(getValue(key));
+        switch (value.type) {
+        case Type::Float: {
+            std::ostringstream oss;
+            oss.precision(6);
+
+            if (std::floor(value.real) == value.real) {
+                oss << std::fixed << std::setprecision(0) << value.real;
+            }
+            else {
+                oss << std::defaultfloat << value.real;
+            }
+            return oss.str();
+        }
+        case Type::String:
+            return std::string(m_buffer.substr(value.data, value.size));
+        case Type::Bool:
+            return value.boolean ? "true" : "false";
+        case Type::Int:
+            return std::to_string(value.integer);
+        case Type::Uint:
+            return std::to_string(value.unsignedInteger);
+        default:
+            return {};
+        }
+    }
+
+    std::optional<ValueView> typedValue(std::string_view key) const override
+    {
+        const Header value = header(getValue(key));
+        ValueView view;
+        switch (value.type) {
+        case Type::Float:
+            view.type = ValueView::type::Double;
+            view.real = value.real;
+            break;
+        case Type::String:
+            view.type = ValueView::type::String;
+            view.string = m_buffer.substr(value.data, value.size);
+            break;
+        case Type::Bool:
+            view.type = ValueView::type::Bool;
+            view.boolean = value.boolean;
+            break;
+        case Type::Int:
+            view.type = ValueView::type::Int;
+            view.integer = value.integer;
+            break;
+        case Type::Uint:
+            view.type = ValueView::type::Uint;
+            view.unsignedInteger = value.unsignedInteger;
+            break;
+        default:
+            break;
+        }
+        return view;
+    }
+
+    size_t listCount(std::string_view key) const override { return resolvedCount(resolve(key)); }
+
+    void push(std::string_view key, int index = -1) override { pushResolved(resolve(key), index); }
+
+    void pop() override
+    {
+        if (!m_contextStack.empty()) {
+            m_contextStack.pop_back();
+        }
+    }
+
+    // Resolved values are kept per depth, as a section is pushed before anything else is resolved at its depth
+    ResolvedKey resolve(std::string_view key) const override
+    {
+        const size_t depth = m_contextStack.size();
+        if (m_resolved.size() < depth) {
+            m_resolved.resize(depth);
+        }
+        Resolved &slot = m_resolved[depth - 1];
+        slot.offset = getValue(key);
+        return {key, &slot};
+    }
+
+    // Elements up to the first malformed one
+    size_t resolvedCount(const ResolvedKey &resolved) const override
+    {
+        const size_t offset = static_cast<const Resolved *>(resolved.value)->offset;
+        const Header array = header(offset);
+        if (array.type != Type::Array) {
+            return 0;
+        }
+        size_t count = 0;
+        for (size_t pos = array.data; count < array.size && pos != npos; pos = skip(pos)) {
+            if (header(pos).type == Type::Invalid) {
+                break;
+            }
+            ++count;
+        }
+        return count;
+    }
+
+    bool resolvedFalse(const ResolvedKey &resolved) const override
+    {
+        return isFalse(header(static_cast<const Resolved *>(resolved.value)->offset));
+    }
+
+    void pushResolved(const ResolvedKey &resolved, int index = -1) override
+    {
+        auto &slot = *const_cast<Resolved *>(static_cast<const Resolved *>(resolved.value));
+        const Header value = header(slot.offset);
+        if (value.type == Type::Invalid || value.type == Type::Nil) {
+            m_contextStack.emplace_back(npos);
+            return;
+        }
+        if (index < 0 || value.type != Type::Array) {
+            m_contextStack.emplace_back(slot.offset);
+            return;
+        }
+
+        // Elements are stepped to from the one pushed before, lists are iterated in order
+        if (slot.list != slot.offset || slot.index > static_cast<size_t>(index)) {
+            slot.list = slot.offset;
+            slot.index = 0;
+            slot.element = value.data;
+        }
+        while (slot.index < static_cast<size_t>(index) && slot.element != npos) {
+            slot.element = skip(slot.element);
+            ++slot.index;
+        }
+        m_contextStack.emplace_back(static_cast<size_t>(index) < value.size ? slot.element : npos);
+    }
+
+private:
+    enum class Type { Invalid, Nil, Bool, Int, Uint, Float, String, Binary, Extension, Array, Map };
+
+    // Decoded type byte and length fields of the value at offset. For containers, data is the offset of the
+    // first item and size the item count, for other values the payload offset and byte length.
+    struct Header {
+        Type type{Type::Invalid};
+        size_t data{0};
+        size_t size{0};
+        bool boolean{false};
+        int64_t integer{0};
+        uint64_t unsignedInteger{0};
+        double real{0};
+    };
+
+    bool readUnsigned(size_t offset, size_t width, uint64_t &value) const
+    {
+        if (offset > m_buffer.size() || m_buffer.size() - offset < width) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < width; ++i) {
+            value = (value << 8) | static_cast<uint8_t>(m_buffer[offset + i]);
+        }
+        return true;
+    }
+
+    Header header(size_t offset) const
+    {
+        Header value;
+        if (offset == npos || offset >= m_buffer.size()) {
+            return value;
+        }
+        const auto byte = static_cast<uint8_t>(m_buffer[offset]);
+        const size_t pos = offset + 1;
+        uint64_t bits = 0;
+
+        // Types with a length field of width bytes in front of their payload or items
+        auto sized = [&](Type type, size_t width) {
+            if (readUnsigned(pos, width, bits)) {
+                value.type = type;
+                value.data = pos + width;
+                value.size = static_cast<size_t>(bits);
+            }
+        };
+        auto scalar = [&](Type type, size_t width) {
+            if (readUnsigned(pos, width, bits)) {
+                value.type = type;
+                value.data = pos;
+                value.size = width;
+            }
+        };
+
+        if (byte <= 0x7f) {
+            value.type = Type::Int;
+            value.integer = byte;
+            value.data = pos;
+        }
+        else if (byte >= 0xe0) {
+            value.type = Type::Int;
+            value.integer = static_cast<int8_t>(byte);
+            value.data = pos;
+        }
+        else if (byte <= 0x8f) {
+            value = {Type::Map, pos, size_t(byte & 0x0f)};
+        }
+        else if (byte <= 0x9f) {
+            value = {Type::Array, pos, size_t(byte & 0x0f)};
+        }
+        else if (byte <= 0xbf) {
+            value = {Type::String, pos, size_t(byte & 0x1f)};
+        }
+        else {
+            switch (byte) {
+            case 0xc0:
+                value = {Type::Nil, pos, 0};
+                break;
+            case 0xc2:
+            case 0xc3:
+                value = {Type::Bool, pos, 0};
+                value.boolean = byte == 0xc3;
+                break;
+            case 0xc4:
+            case 0xc5:
+            case 0xc6:
+                sized(Type::Binary, size_t(1) << (byte - 0xc4));
+                break;
+            case 0xc7:
+            case 0xc8:
+            case 0xc9:
+                // Extension payloads follow their type byte
+                sized(Type::Extension, size_t(1) << (byte - 0xc7));
+                ++value.size;
+                break;
+            case 0xca:
+                scalar(Type::Float, 4);
+                if (value.type == Type::Float) {
+                    float number;
+                    const auto narrow = static_cast<uint32_t>(bits);
+                    std::memcpy(&number, &narrow, sizeof(number));
+                    value.real = number;
+                }
+                break;
+            case 0xcb:
+                scalar(Type::Float, 8);
+                std::memcpy(&value.real, &bits, sizeof(value.real));
+                break;
+            case 0xcc:
+            case 0xcd:
+            case 0xce:
+            case 0xcf:
+                scalar(Type::Uint, size_t(1) << (byte - 0xcc));
+                value.unsignedInteger = bits;
+                break;
+            case 0xd0:
+            case 0xd1:
+            case 0xd2:
+            case 0xd3: {
+                const size_t width = size_t(1) << (byte - 0xd0);
+                scalar(Type::Int, width);
+                // Sign extend from the encoded width
+                const unsigned shift = static_cast<unsigned>(64 - width * 8);
+                value.integer = static_cast<int64_t>(bits << shift) >> shift;
+                break;
+            }
+            case 0xd4:
+            case 0xd5:
+            case 0xd6:
+            case 0xd7:
+            case 0xd8:
+                value = {Type::Extension, pos, (size_t(1) << (byte - 0xd4)) + 1};
+                break;
+            case 0xd9:
+            case 0xda:
+            case 0xdb:
+                sized(Type::String, size_t(1) << (byte - 0xd9));
+                break;
+            case 0xdc:
+            case 0xdd:
+                sized(Type::Array, size_t(2) << (byte - 0xdc));
+                break;
+            case 0xde:
+            case 0xdf:
+                sized(Type::Map, size_t(2) << (byte - 0xde));
+                break;
+            default:
+                break;
+            }
+        }
+
+        const bool container = value.type == Type::Array || value.type == Type::Map;
+        if (value.type != Type::Invalid && !container && (value.data > m_buffer.size() || m_buffer.size() - value.data < value.size)) {
+            return Header{};
+        }
+        return value;
+    }
+
+    // Offset past the value at offset, npos if it is malformed or truncated
+    size_t skip(size_t offset) const
+    {
+        size_t pending = 1;
+        while (pending > 0) {
+            const Header value = header(offset);
+            if (value.type == Type::Invalid) {
+                return npos;
+            }
+            --pending;
+            if (value.type == Type::Array || value.type == Type::Map) {
+                const size_t items = value.type == Type::Map ? value.size * 2 : value.size;
+                // Every item takes at least a byte
+                if (items > m_buffer.size() - value.data || pending > m_buffer.size() - value.data - items) {
+                    return npos;
+                }
+                pending += items;
+                offset = value.data;
+            }
+            else {
+                offset = value.data + value.size;
+            }
+        }
+        return offset;
+    }
+
+    bool isFalse(const Header &value) const
+    {
+        switch (value.type) {
+        case Type::Bool:
+            return !value.boolean;
+        case Type::String:
+            return isFalseString(m_buffer.substr(value.data, value.size));
+        case Type::Nil:
+        case Type::Invalid:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Value of the last key resolved at a depth, and the last element pushed from it if it is a list
+    struct Resolved {
+        size_t offset{npos};
+        size_t list{npos};
+        size_t index{0};
+        size_t element{npos};
+    };
+
+    struct Frame {
+        explicit Frame(size_t frameOffset) : offset(frameOffset) {}
+
+        size_t offset; // npos for missing data
+        mutable uint32_t probes{0}; // lookups into the map, until it gets an index
+        mutable std::unique_ptr<std::unordered_map<std::string_view, size_t>> index;
+    };
+
+    // Maps up to this size are scanned until looked into repeatedly
+    static constexpr size_t smallMap = 16;
+    static constexpr uint32_t indexAfter = 4;
+
+    // Offset of the value for key in the map at the frame, npos if the frame is no map or lacks the key
+    size_t find(const Frame &frame, std::string_view key) const
+    {
+        if (frame.offset == npos) {
+            return npos;
+        }
+        const Header map = header(frame.offset);
+        if (map.type != Type::Map) {
+            return npos;
+        }
+        if (!frame.index && (map.size > smallMap || ++frame.probes > indexAfter)) {
+            frame.index = std::make_unique<std::unordered_map<std::string_view, size_t>>();
+            forEachMember(map, [&frame](std::string_view name, size_t value) {
+                frame.index->emplace(name, value);
+                return true;
+            });
+        }
+        if (frame.index) {
+            auto found = frame.index->find(key);
+            return found != frame.index->end() ? found->second : npos;
+        }
+
+        size_t result = npos;
+        forEachMember(map, [&](std::string_view name, size_t value) {
+            if (name != key) {
+                return true;
+            }
+            result = value;
+            return false;
+        });
+        return result;
+    }
+
+    // Calls visit with each string key and the offset of its value, until it returns false
+    template<class Visit>
+    void forEachMember(const Header &map, Visit &&visit) const
+    {
+        size_t pos = map.data;
+        for (size_t i = 0; i < map.size && pos != npos; ++i) {
+            const Header key = header(pos);
+            const size_t valueOffset = skip(pos);
+            if (valueOffset == npos) {
+                break;
+            }
+            if (key.type == Type::String && !visit(m_buffer.substr(key.data, key.size), valueOffset)) {
+                break;
+            }
+            pos = skip(valueOffset);
+        }
+    }
+
+    std::string_view m_buffer;
+    std::vector<Frame> m_contextStack;
+    // Deque so that resolved keys keep pointing at their slot as deeper ones are added
+    mutable std::deque<Resolved> m_resolved;
+};
+} // namespace boost::mustache
@@ -0,0 +1,221 @@
+#pragma once
+#include <boost/mustache.hpp>
+#include <simdjson.h>
+#include <deque>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+namespace boost::mustache {
+// Context reading a simdjson DOM in place. Frames are elements referring into the parser's tape and keys are
+// looked up without copying, strings are only copied when rendered. The parser that produced the root must
+// outlive the context and must not parse another document in the meantime.
+class SimdJsonContext : public Context {
+public:
+    explicit SimdJsonContext(simdjson::dom::element root, std::shared_ptr<PartialResolver> resolver = nullptr)
+        : Context(std::move(resolver))
+    {
+        m_contextStack.emplace_back(root);
+    }
+
+    // Null if the key is missing
+    std::optional<simdjson::dom::element> getValue(std::string_view key) const
+    {
+        if (key == ".") {
+            countLookup(true);
+            return m_contextStack.back();
+        }
+
+        for (auto it = m_contextStack.rbegin(); it != m_contextStack.rend(); ++it) {
+            simdjson::dom::object object;
+            if (!*it || it->value().get_object().get(object) != simdjson::SUCCESS) {
+                continue;
+            }
+            simdjson::dom::element value;
+            if (object.at_key(key).get(value) == simdjson::SUCCESS) {
+                countLookup(true);
+                return value;
+            }
+        }
+        countLookup(false);
+        return std::nullopt;
+    }
+
+    bool isFalse(std::string_view key) const override { return isFalse(getValue(key)); }
+
+    std::string stringValue(std::string_view key) const override
+    {
+        auto value = getValue(key);
+        if (!value) {
+            return {};
+        }
+
+        switch (value->type()) {
+        case simdjson::dom::element_type::DOUBLE: {
+            std::ostringstream oss;
+            oss.precision(6);
+
+            if (const double dvalue = double(*value); std::floor(dvalue) == dvalue) {
+                oss << std::fixed << std::setprecision(0) << dvalue;
+            }
+            else {
+                oss << std::defaultfloat << dvalue;
+            }
+            return oss.str();
+        }
+        case simdjson::dom::element_type::STRING:
+            return std::string(std::string_view(*value));
+        case simdjson::dom::element_type::BOOL:
+            return bool(*value) ? "true" : "false";
+        case simdjson::dom::element_type::INT64:
+            return std::to_string(int64_t(*value));
+        case simdjson::dom::element_type::UINT64:
+            return std::to_string(uint64_t(*value));
+        default:
+            return {};
+        }
+    }
+
+    std::optional<ValueView> typedValue(std::string_view key) const override
+    {
+        auto value = getValue(key);
+        ValueView view;
+        if (!value) {
+            return view;
+        }
+
+        switch (value->type()) {
+        case simdjson::dom::element_type::DOUBLE:
+            view.type = ValueView::type::Double;
+            view.real = double(*value);
+            break;
+        case simdjson::dom::element_type::STRING:
+            view.type = ValueView::type::String;
+            view.string = std::string_view(*value);
+            break;
+        case simdjson::dom::element_type::BOOL:
+            view.type = ValueView::type::Bool;
+            view.boolean = bool(*value);
+            break;
+        case simdjson::dom::element_type::INT64:
+            view.type = ValueView::type::Int;
+            view.integer = int64_t(*value);
+            break;
+        case simdjson::dom::element_type::UINT64:
+            view.type = ValueView::type::Uint;
+            view.unsignedInteger = uint64_t(*value);
+            break;
+        default:
+            break;
+        }
+        return view;
+    }
+
+    size_t listCount(std::string_view key) const override { return resolvedCount(resolve(key)); }
+
+    void push(std::string_view key, int index = -1) override { pushResolved(resolve(key), index); }
+
+    void pop() override
+    {
+        if (!m_contextStack.empty()) {
+            m_contextStack.pop_back();
+        }
+    }
+
+    // Resolved values are kept per depth, as a section is pushed before anything else is resolved at its depth
+    ResolvedKey resolve(std::string_view key) const override
+    {
+        const size_t depth = m_contextStack.size();
+        if (m_resolved.size() < depth) {
+            m_resolved.resize(depth);
+        }
+        Resolved &slot = m_resolved[depth - 1];
+        slot.value = getValue(key);
+        return {key, &slot};
+    }
+
+    size_t resolvedCount(const ResolvedKey &resolved) const override
+    {
+        const auto &value = static_cast<const Resolved *>(resolved.value)->value;
+        simdjson::dom::array array;
+        if (!value || value->get_array().get(array) != simdjson::SUCCESS) {
+            return 0;
+        }
+        return array.size();
+    }
+
+    bool resolvedFalse(const ResolvedKey &resolved) const override
+    {
+        return isFalse(static_cast<const Resolved *>(resolved.value)->value);
+    }
+
+    // List elements are reached from the one pushed before them, as arrays are only walked forward on the tape
+    void pushResolved(const ResolvedKey &resolved, int index = -1) override
+    {
+        auto &slot = *const_cast<Resolved *>(static_cast<const Resolved *>(resolved.value));
+        if (!slot.value || slot.value->is_null()) {
+            m_contextStack.emplace_back();
+            return;
+        }
+
+        simdjson::dom::array array;
+        if (index < 0 || slot.value->get_array().get(array) != simdjson::SUCCESS) {
+            m_contextStack.push_back(slot.value);
+            return;
+        }
+        if (static_cast<size_t>(index) >= array.size()) {
+            m_contextStack.emplace_back();
+            return;
+        }
+
+        if (slot.list == array.begin() && slot.index + 1 == index) {
+            ++slot.element;
+        }
+        else {
+            slot.list = array.begin();
+            slot.element = std::next(array.begin(), index);
+        }
+        slot.index = index;
+        m_contextStack.emplace_back(*slot.element);
+    }
+
+private:
+    // Value of the last key resolved at a depth, and the last element pushed from it if it is a list
+    struct Resolved {
+        std::optional<simdjson::dom::element> value;
+        simdjson::dom::array::iterator list;
+        simdjson::dom::array::iterator element;
+        int index{-1};
+    };
+
+    static bool isFalse(const std::optional<simdjson::dom::element> &value)
+    {
+        if (!value || value->is_null()) {
+            return true;
+        }
+
+        bool flag;
+        if (value->get_bool().get(flag) == simdjson::SUCCESS) {
+            return !flag;
+        }
+
+        std::string_view str;
+        if (value->get_string().get(str) == simdjson::SUCCESS) {
+            return isFalseString(str);
+        }
+
+        return false;
+    }
+
+    std::vector<std::optional<simdjson::dom::element>> m_contextStack; // null for missing data
+    // Deque so that resolved keys keep pointing at their slot as deeper ones are added
+    mutable std::deque<Resolved> m_resolved;
+};
+
+inline std::string render(const Template &compiledTemplate, simdjson::dom::element args, size_t sizeHint = 0)
+{
+    SimdJsonContext context(args);
+    Renderer renderer;
+    return renderer.render(compiledTemplate, &context, sizeHint);
+}
+} // namespace boost::mustache
@@ -1,7 +1,20 @@
 ﻿#include <gtest/gtest.h>
 #include <boost/mustache.hpp>
+#include <boost/mustache/asio.hpp>
+#include <boost/mustache/columnar.hpp>
+#include <boost/mustache/json_stream.hpp>
+#include <boost/mustache/msgpack.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read.hpp>
 #include <boost/json.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <atomic>
+#include <thread>
+#ifdef BOOST_MUSTACHE_HAS_SIMDJSON
+#include <boost/mustache/simdjson.hpp>
+#endif
 
 class MustacheTest : public ::testing::Test {
 protected:
@@ -86,6 +99,28 @@ TEST_F(MustacheTest, ListIteration)
 
     std::string jsonResult = boost::mustache::render(templ, jsonData);
     EXPECT_EQ(jsonResult, "- Item1\n- Item2\n");
+
+    // Frames point into the tree: the same list twice, nested in itself, and outer keys seen from the elements
+    ptreeData.put("name", "Top");
+    EXPECT_EQ(boost::mustache::render("{{#items}}{{name}}{{/items}}|{{#items}}{{name}}{{/items}}", ptreeData),
+            "Item1Item2|Item1Item2");
+    EXPECT_EQ(boost::mustache::render("{{#items}}{{name}}[{{#items}}{{name}}{{/items}}]{{/items}}", ptreeData),
+            "Item1[Item1Item2]Item2[Item1Item2]");
+    EXPECT_EQ(boost::mustache::render("{{#items}}{{#missing}}x{{/missing}}{{age}}{{/items}}", ptreeData), "3030");
+
+    // Dotted keys walk the tree, wide trees included, and a moved context keeps rendering its own copy
+    for (int i = 0; i < 40; ++i) {
+        ptreeData.put("wide.k" + std::to_string(i), i);
+    }
+    static_assert(!std::is_copy_constructible_v<boost::mustache::PropertyTreeContext>);
+    boost::mustache::PropertyTreeContext moved(ptreeData);
+    ptreeData.put("name", "Changed");
+    boost::mustache::PropertyTreeContext treeContext(std::move(moved));
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(boost::mustache::Template("{{name}} {{wide.k7}}{{wide.k39}}"
+                                                        "{{wide.k40}}{{name.x}}"),
+                      &treeContext),
+            "Top 739");
 }
 
 TEST_F(MustacheTest, NestedSections)
@@ -140,4 +175,876 @@ TEST_F(MustacheTest, CustomRendereFunc)
     // Test with JSON
     std::string jsonResult = boost::mustache::render(templ, jsonData);
     EXPECT_EQ(jsonResult, "Hello JOHN!");
-}
\ No newline at end of file
+}
+
+TEST_F(MustacheTest, RenderStats)
+{
+    boost::mustache::JsonContext context(jsonData);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render("Hello {{name}} {{missing}}{{{name}}}!", &context), "Hello John John!");
+
+    const auto &stats = renderer.stats();
+    EXPECT_EQ(stats.tags, 3u);
+    EXPECT_EQ(stats.lookups, 3u);
+    EXPECT_EQ(stats.lookupMisses, 1u);
+    EXPECT_EQ(stats.escapes, 2u);
+    EXPECT_EQ(stats.bytesEscaped, 4u);
+    EXPECT_EQ(stats.bytesCopied, 12u);
+    EXPECT_EQ(stats.outputSize, 16u);
+}
+
+TEST_F(MustacheTest, CompiledTemplate)
+{
+    const boost::mustache::Template templ("Hello {{name}}!");
+    ASSERT_TRUE(templ.valid());
+    EXPECT_EQ(templ.sizeEstimate(), 0u);
+
+    EXPECT_EQ(boost::mustache::render(templ, ptreeData), "Hello John!");
+    EXPECT_EQ(templ.sizeEstimate(), 11u);
+
+    EXPECT_EQ(boost::mustache::render(templ, jsonData, 4096), "Hello John!");
+    EXPECT_EQ(templ.sizeEstimate(), 11u);
+
+    const boost::mustache::Template broken("{{#items}}");
+    EXPECT_FALSE(broken.valid());
+    EXPECT_EQ(broken.errorPos(), 0u);
+
+    boost::mustache::JsonContext context(jsonData);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(broken, &context), "");
+    EXPECT_EQ(renderer.error(), "No matching end tag found for section");
+}
+
+TEST_F(MustacheTest, IoVecOutput)
+{
+    const boost::mustache::Template templ("Hello {{name}}, you are {{age}}!");
+    boost::mustache::JsonContext context(jsonData);
+    boost::mustache::Renderer renderer;
+    boost::mustache::IoVecSink sink;
+    renderer.render(templ, &context, sink);
+
+    EXPECT_EQ(sink.str(), "Hello John, you are 30!");
+    EXPECT_EQ(sink.size(), 23u);
+    ASSERT_EQ(sink.segments().size(), 5u);
+    // Literal text is referenced in place, not copied
+    EXPECT_EQ(sink.segments()[0].data(), templ.source().data());
+    EXPECT_EQ(sink.segments()[2].data(), templ.source().data() + 14);
+}
+
+TEST_F(MustacheTest, ChunkedRendering)
+{
+    boost::json::array items;
+    for (int i = 0; i < 100; ++i) {
+        items.push_back({{"name", "Item" + std::to_string(i)}});
+    }
+    jsonData.as_object()["items"] = items;
+
+    const boost::mustache::Template templ("{{name}}: {{#items}}- {{name}}\n{{/items}}{{^items}}none{{/items}}done");
+    const std::string expected = boost::mustache::render(templ, jsonData);
+
+    boost::mustache::JsonContext context(jsonData);
+    boost::mustache::RenderStream stream(templ, &context);
+    std::string result;
+    char buffer[7];
+    while (size_t size = stream.nextChunk(buffer, sizeof(buffer))) {
+        EXPECT_LE(size, sizeof(buffer));
+        result.append(buffer, size);
+    }
+    EXPECT_TRUE(stream.done());
+    EXPECT_FALSE(stream.renderer().errorPos());
+    EXPECT_EQ(result, expected);
+}
+
+TEST_F(MustacheTest, FunctionRegistryHandles)
+{
+    const boost::mustache::Template templ("{{#WRAP}}{{name}}{{/WRAP}}");
+    EXPECT_EQ(boost::mustache::render(templ, jsonData), "");
+
+    // Registered after the template was compiled
+    boost::mustache::registerFunction(
+            "WRAP", [](std::string_view text, boost::mustache::Renderer *renderer, boost::mustache::Context *ctx) {
+                return "[" + renderer->render(text, ctx) + "]";
+            });
+    EXPECT_EQ(boost::mustache::render(templ, jsonData), "[John]");
+
+    auto &registry = boost::mustache::FunctionRegistry::instance();
+    const auto slot = registry.resolve("WRAP");
+    ASSERT_NE(slot.function, nullptr);
+    EXPECT_EQ(slot.version, registry.version());
+    EXPECT_EQ(registry.find("WRAP", &slot), slot.function);
+
+    registry.registerFunction("WRAP_OTHER", [](std::string_view, boost::mustache::Renderer *, boost::mustache::Context *) {
+        return std::string();
+    });
+    EXPECT_NE(slot.version, registry.version());
+    EXPECT_EQ(registry.find("WRAP"), slot.function);
+    EXPECT_EQ(registry.find("MISSING"), nullptr);
+
+    // Handles to superseded functions stay valid while lookups run concurrently with registration
+    std::atomic<bool> done{false};
+    std::thread reader([&] {
+        while (!done.load()) {
+            EXPECT_NE(registry.find("WRAP"), nullptr);
+        }
+    });
+    for (int i = 0; i < 100; ++i) {
+        registry.registerFunction("WRAP", [](std::string_view, boost::mustache::Renderer *, boost::mustache::Context *) {
+            return std::string("re");
+        });
+    }
+    done = true;
+    reader.join();
+    EXPECT_NE(registry.find("WRAP"), slot.function);
+    EXPECT_TRUE(slot.function->text);
+    EXPECT_EQ(boost::mustache::render(templ, jsonData), "re");
+}
+
+TEST_F(MustacheTest, ScopedFunctionSets)
+{
+    auto tag = [](std::string prefix) {
+        return [prefix](std::string_view text, boost::mustache::Renderer *renderer, boost::mustache::Context *ctx) {
+            return prefix + renderer->render(text, ctx);
+        };
+    };
+
+    auto tenantA = std::make_shared<boost::mustache::FunctionSet>();
+    tenantA->registerFunction("BRAND", tag("A:"));
+    auto tenantB = std::make_shared<boost::mustache::FunctionSet>();
+    tenantB->registerFunction("BRAND", tag("B:"));
+
+    const boost::mustache::Template templ("{{#BRAND}}{{name}}{{/BRAND}}");
+    boost::mustache::JsonContext contextA(jsonData);
+    contextA.setFunctions(tenantA);
+    boost::mustache::JsonContext contextB(jsonData);
+    contextB.setFunctions(tenantB);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &contextA), "A:John");
+    EXPECT_EQ(renderer.render(templ, &contextB), "B:John");
+    EXPECT_EQ(boost::mustache::render(templ, jsonData), "");
+
+    // Template functions sit between the context's and the global registry
+    boost::mustache::Template scoped("{{#BRAND}}{{name}}{{/BRAND}}");
+    auto templateFunctions = std::make_shared<boost::mustache::FunctionSet>();
+    templateFunctions->registerFunction("BRAND", tag("T:"));
+    scoped.setFunctions(templateFunctions);
+    EXPECT_EQ(boost::mustache::render(scoped, jsonData), "T:John");
+    EXPECT_EQ(renderer.render(scoped, &contextA), "A:John");
+}
+
+TEST_F(MustacheTest, SectionFunction)
+{
+    boost::mustache::registerSectionFunction(
+            "SHOUT", [](const boost::mustache::Section &section, boost::mustache::OutputSink &sink) {
+                std::string result = section.render();
+                std::transform(result.begin(), result.end(), result.begin(), ::toupper);
+                sink.write(result);
+            });
+    boost::mustache::registerSectionFunction(
+            "TWICE", [](const boost::mustache::Section &section, boost::mustache::OutputSink &sink) {
+                section.render(sink);
+                sink.write("|");
+                section.render(sink);
+            });
+
+    const boost::mustache::Template templ("{{#SHOUT}}Hi {{name}}{{/SHOUT}} {{#TWICE}}{{#isActive}}{{age}}{{/isActive}}{{/TWICE}}!");
+    boost::mustache::JsonContext context(jsonData);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &context), "HI JOHN 30|30!");
+    EXPECT_EQ(renderer.stats().outputSize, 14u);
+    EXPECT_EQ(boost::mustache::render(templ, ptreeData), "HI JOHN 30|30!");
+}
+
+TEST_F(MustacheTest, PureFunctionCache)
+{
+    int calls = 0;
+    boost::mustache::registerPureFunction("PRICE", [&calls](std::string_view amount) {
+        ++calls;
+        return "$" + std::string(amount);
+    });
+
+    const boost::mustache::Template templ("{{#items}}{{#PRICE}}{{price}}{{/PRICE}} {{/items}}");
+    boost::json::value data = boost::json::parse(R"({"items": [{"price": 5}, {"price": 7}, {"price": 5}, {"price": 5}]})");
+    boost::mustache::JsonContext context(data);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &context), "$5 $7 $5 $5 ");
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(renderer.stats().functionCacheHits, 2u);
+
+    // Per-render cache starts empty again
+    EXPECT_EQ(renderer.render(templ, &context), "$5 $7 $5 $5 ");
+    EXPECT_EQ(calls, 4);
+
+    auto cache = std::make_shared<boost::mustache::FunctionCache>(1);
+    renderer.setFunctionCache(cache);
+    EXPECT_EQ(renderer.render(templ, &context), "$5 $7 $5 $5 ");
+    EXPECT_EQ(calls, 7);
+    EXPECT_EQ(cache->size(), 1u);
+    EXPECT_EQ(renderer.render(templ, &context), "$5 $7 $5 $5 ");
+    EXPECT_EQ(calls, 9);
+
+    // Registering the name again must not serve results cached for the replaced function
+    auto functions = std::make_shared<boost::mustache::FunctionSet>();
+    functions->registerPureFunction("PRICE", [](std::string_view amount) { return "$" + std::string(amount); });
+    context.setFunctions(functions);
+    renderer.setFunctionCache(std::make_shared<boost::mustache::FunctionCache>());
+    EXPECT_EQ(renderer.render(templ, &context), "$5 $7 $5 $5 ");
+    functions->registerPureFunction("PRICE", [](std::string_view amount) { return std::string(amount) + " EUR"; });
+    EXPECT_EQ(renderer.render(templ, &context), "5 EUR 7 EUR 5 EUR 5 EUR ");
+}
+
+TEST_F(MustacheTest, SectionCache)
+{
+    const boost::mustache::Template templ("{{#comments}}{{text}} by {{#author}}<{{name}}>{{/author}}; {{/comments}}");
+    boost::json::value data = boost::json::parse(R"({"comments": [
+        {"text": "a", "author": {"name": "Ann"}},
+        {"text": "b", "author": {"name": "Bob"}},
+        {"text": "c", "author": {"name": "Ann"}}
+    ]})");
+
+    auto cache = std::make_shared<boost::mustache::SectionCache>(1024);
+    cache->memoize("author");
+    boost::mustache::JsonContext context(data);
+    boost::mustache::Renderer renderer;
+    renderer.setSectionCache(cache);
+    const std::string expected = "a by <Ann>; b by <Bob>; c by <Ann>; ";
+    EXPECT_EQ(renderer.render(templ, &context), expected);
+    EXPECT_EQ(renderer.stats().sectionCacheHits, 1u);
+    // Two outputs of 5 bytes, each with its 33 byte data encoding
+    EXPECT_EQ(cache->bytes(), 76u);
+    EXPECT_THROW(cache->memoize("comments"), std::logic_error);
+
+    EXPECT_EQ(renderer.render(templ, &context), expected);
+    EXPECT_EQ(renderer.stats().sectionCacheHits, 3u);
+
+    // Entries beyond the byte budget are evicted
+    auto small = std::make_shared<boost::mustache::SectionCache>(40);
+    small->memoize("author");
+    renderer.setSectionCache(small);
+    EXPECT_EQ(renderer.render(templ, &context), expected);
+    EXPECT_EQ(renderer.stats().sectionCacheHits, 0u);
+    EXPECT_EQ(small->bytes(), 38u);
+}
+
+TEST_F(MustacheTest, IncrementalRender)
+{
+    const boost::mustache::Template templ("<h1>{{title}}</h1>{{#stats}}<b>{{visits}}</b>{{/stats}}"
+                                          "{{#items}}<li>{{name}}</li>{{/items}}<p>{{footer}}</p>");
+    boost::json::value data = boost::json::parse(R"({
+        "title": "Dashboard", "stats": {"visits": 10}, "items": [{"name": "a"}, {"name": "b"}], "footer": "x"
+    })");
+
+    boost::mustache::IncrementalRenderer incremental(templ);
+    boost::mustache::JsonContext context(data);
+    EXPECT_EQ(incremental.render(&context), "<h1>Dashboard</h1><b>10</b><li>a</li><li>b</li><p>x</p>");
+    EXPECT_EQ(incremental.renderedSections(), 2u);
+
+    data.as_object()["stats"].as_object()["visits"] = 11;
+    data.as_object()["items"].as_array()[1].as_object()["name"] = "c";
+    boost::mustache::JsonContext changed(data);
+    EXPECT_EQ(incremental.update(&changed, {"stats.visits", "items.1.name"}),
+            "<h1>Dashboard</h1><b>11</b><li>a</li><li>c</li><p>x</p>");
+    EXPECT_EQ(incremental.renderedSections(), 2u);
+
+    data.as_object()["title"] = "Home";
+    boost::mustache::JsonContext retitled(data);
+    EXPECT_EQ(incremental.update(&retitled, {"title"}), "<h1>Home</h1><b>11</b><li>a</li><li>c</li><p>x</p>");
+    EXPECT_EQ(incremental.renderedSections(), 0u);
+    EXPECT_EQ(boost::mustache::render(templ, data), incremental.output());
+
+    // Sections nested in one root section are spliced at their own level
+    const boost::mustache::Template wrapped("{{#page}}<h1>{{title}}</h1>{{#stats}}<b>{{visits}}</b>{{/stats}}"
+                                            "{{#items}}<li>{{name}}{{#tags}}[{{.}}]{{/tags}}</li>{{/items}}{{/page}}");
+    boost::json::value page = boost::json::parse(R"({"page": {
+        "title": "Dashboard", "stats": {"visits": 10}, "items": [{"name": "a", "tags": ["x"]}, {"name": "b", "tags": null}]
+    }})");
+    boost::mustache::IncrementalRenderer nested(wrapped);
+    boost::mustache::JsonContext pageContext(page);
+    EXPECT_EQ(nested.render(&pageContext), "<h1>Dashboard</h1><b>10</b><li>a[x]</li><li>b</li>");
+    EXPECT_EQ(nested.renderedSections(), 5u);
+
+    page.as_object()["page"].as_object()["stats"].as_object()["visits"] = 11;
+    boost::mustache::JsonContext pageChanged(page);
+    EXPECT_EQ(nested.update(&pageChanged, {"page.stats.visits"}), "<h1>Dashboard</h1><b>11</b><li>a[x]</li><li>b</li>");
+    EXPECT_EQ(nested.renderedSections(), 2u);
+
+    page.as_object()["page"].as_object()["items"].as_array()[1].as_object()["tags"] = boost::json::array{"y"};
+    boost::mustache::JsonContext tagged(page);
+    EXPECT_EQ(nested.update(&tagged, {"page.items.1.tags"}), "<h1>Dashboard</h1><b>11</b><li>a[x]</li><li>b[y]</li>");
+    EXPECT_EQ(nested.renderedSections(), 3u);
+
+    page.as_object()["page"].as_object()["title"] = "Home";
+    boost::mustache::JsonContext pageRetitled(page);
+    EXPECT_EQ(nested.update(&pageRetitled, {"page.title"}), "<h1>Home</h1><b>11</b><li>a[x]</li><li>b[y]</li>");
+    EXPECT_EQ(nested.renderedSections(), 1u);
+    EXPECT_EQ(boost::mustache::render(wrapped, page), nested.output());
+}
+
+TEST_F(MustacheTest, TemplateAnalysis)
+{
+    class Partials : public boost::mustache::PartialResolver {
+    public:
+        std::string getPartial(std::string_view name) override
+        {
+            if (name == "card") {
+                return "{{#author}}{{name}}{{/author}}{{>card}}";
+            }
+            return "{{#broken}}";
+        }
+    };
+
+    boost::mustache::registerFunction("ANALYZE_UPPER", [](std::string_view text, boost::mustache::Renderer *renderer,
+                                                               boost::mustache::Context *ctx) { return renderer->render(text, ctx); });
+
+    const boost::mustache::Template templ("{{title}}{{#comments}}{{text}}{{>card}}{{/comments}}{{^comments}}none{{/comments}}"
+                                          "{{#tags}}{{.}}{{/tags}}{{#ANALYZE_UPPER}}{{footer}}{{/ANALYZE_UPPER}}{{>missing}}");
+    Partials partials;
+    const auto analysis = boost::mustache::analyze(templ, &partials);
+
+    EXPECT_EQ(analysis.keys, (std::set<std::string>{"title", "comments.text", "comments.author.name", "tags", "footer"}));
+    ASSERT_EQ(analysis.sections.size(), 3u);
+    EXPECT_TRUE(analysis.sections.at("comments").section);
+    EXPECT_TRUE(analysis.sections.at("comments").inverted);
+    EXPECT_FALSE(analysis.sections.at("comments").items);
+    EXPECT_TRUE(analysis.sections.at("comments.author").section);
+    EXPECT_TRUE(analysis.sections.at("tags").items);
+    EXPECT_EQ(analysis.partials, (std::set<std::string>{"card", "missing"}));
+    EXPECT_EQ(analysis.invalidPartials, (std::set<std::string>{"missing"}));
+    EXPECT_EQ(analysis.functions, (std::set<std::string>{"ANALYZE_UPPER"}));
+}
+
+TEST_F(MustacheTest, Projection)
+{
+    const boost::mustache::Template templ("{{title}}: {{#items}}{{name}} {{#owner}}({{name}}, {{site}}){{/owner}}; {{/items}}"
+                                          "{{^archived}}live{{/archived}}");
+    boost::json::value data = boost::json::parse(R"({
+        "title": "Shop", "site": "example.org", "archived": false, "unused": {"large": [1, 2, 3]},
+        "items": [
+            {"name": "a", "price": 1, "owner": {"name": "Ann", "email": "ann@example.org"}},
+            {"name": "b", "price": 2}
+        ]
+    })");
+
+    const boost::json::value projected = boost::mustache::project(templ, data);
+    EXPECT_EQ(boost::mustache::render(templ, projected), boost::mustache::render(templ, data));
+    EXPECT_EQ(boost::mustache::render(templ, projected), "Shop: a (Ann, example.org); b ; live");
+
+    const auto &object = projected.as_object();
+    EXPECT_EQ(object.size(), 4u);
+    EXPECT_EQ(object.if_contains("unused"), nullptr);
+    const auto &items = object.if_contains("items")->as_array();
+    ASSERT_EQ(items.size(), 2u);
+    EXPECT_EQ(items[0].as_object().if_contains("price"), nullptr);
+    EXPECT_EQ(items[0].as_object().if_contains("owner")->as_object().if_contains("email"), nullptr);
+}
+
+TEST_F(MustacheTest, JsonStreamRendering)
+{
+    const boost::mustache::Template templ("<h1>{{title}}</h1><ul>{{#rows}}<li>{{id}}: {{name}} ({{title}})</li>{{/rows}}</ul>"
+                                          "{{footer}}{{missing}}!");
+    const std::string json = R"({"title": "Export", "rows": [{"id": 1, "name": "a"}, {"id": 2, "name": "b"},
+        {"id": 3, "name": "c"}], "footer": "done"})";
+
+    std::string output;
+    boost::mustache::StringSink sink(output);
+    boost::mustache::JsonStreamRenderer renderer(templ, sink);
+    boost::system::error_code ec;
+    const size_t split = json.find("{\"id\": 3");
+    ASSERT_TRUE(renderer.write(std::string_view(json).substr(0, split), ec));
+    // The first rows render before the rest of the document arrives
+    EXPECT_EQ(output, "<h1>Export</h1><ul><li>1: a (Export)</li><li>2: b (Export)</li>");
+    ASSERT_TRUE(renderer.write(std::string_view(json).substr(split), ec));
+    ASSERT_TRUE(renderer.finish(ec));
+    EXPECT_EQ(output, "<h1>Export</h1><ul><li>1: a (Export)</li><li>2: b (Export)</li><li>3: c (Export)</li></ul>done!");
+    EXPECT_EQ(output, boost::mustache::render(templ, boost::json::parse(json)));
+    EXPECT_EQ(renderer.streamedElements(), 3u);
+
+    // Nodes wait for every root member their subtree may fall back to, and lists other nodes use are kept
+    auto stream = [](std::string_view text, std::string_view data) {
+        const boost::mustache::Template streamed{std::string(text)};
+        std::string result;
+        boost::mustache::StringSink resultSink(result);
+        boost::mustache::JsonStreamRenderer streaming(streamed, resultSink);
+        boost::system::error_code error;
+        for (size_t pos = 0; pos < data.size(); pos += 3) {
+            EXPECT_TRUE(streaming.write(data.substr(pos, 3), error));
+        }
+        EXPECT_TRUE(streaming.finish(error));
+        EXPECT_EQ(result, boost::mustache::render(streamed, boost::json::parse(data)));
+        return result;
+    };
+    EXPECT_EQ(stream("{{#rows}}{{id}}{{/rows}}|{{#meta}}{{#rows}}x{{/rows}}{{/meta}}",
+                      R"({"rows": [{"id": 1}, {"id": 2}], "meta": {"on": true}})"),
+            "12|xx");
+    EXPECT_EQ(stream("{{#rows}}{{id}}{{cur}} {{/rows}}", R"({"rows": [{"id": 1}, {"id": 2}], "cur": "EUR"})"), "1EUR 2EUR ");
+    EXPECT_EQ(stream("{{#user}}{{name}}@{{site}}{{/user}}", R"({"user": {"name": "a"}, "site": "x.org"})"), "a@x.org");
+
+    // A repeated root key renders with the value present when the node is ready, where parsing the whole document
+    // keeps the last one
+    const boost::mustache::Template repeated("{{#rows}}{{id}}{{/rows}}");
+    const std::string duplicate = R"({"rows": [{"id": 1}, {"id": 2}], "rows": [{"id": 3}]})";
+    std::string repeatedOutput;
+    boost::mustache::StringSink repeatedSink(repeatedOutput);
+    boost::mustache::JsonStreamRenderer repeatedRenderer(repeated, repeatedSink);
+    ASSERT_TRUE(repeatedRenderer.write(duplicate, ec));
+    ASSERT_TRUE(repeatedRenderer.finish(ec));
+    EXPECT_EQ(repeatedOutput, "12");
+    EXPECT_EQ(boost::mustache::render(repeated, boost::json::parse(duplicate)), "3");
+
+    std::string invalid;
+    boost::mustache::StringSink invalidSink(invalid);
+    boost::mustache::JsonStreamRenderer truncated(templ, invalidSink);
+    EXPECT_TRUE(truncated.write(R"({"title": "x", "rows": [)", ec));
+    EXPECT_FALSE(truncated.finish(ec));
+    EXPECT_TRUE(ec);
+}
+
+TEST_F(MustacheTest, MsgPackContext)
+{
+    // {"name": "John", "age": 30, "isActive": true, "balance": -1.5, "big": 4294967296,
+    //  "items": [{"name": "a"}, {"name": "b"}], "none": nil, "flag": "False"}
+    const char data[] = "\x88"
+                        "\xa4name\xa4John"
+                        "\xa3" "age\x1e"
+                        "\xa8isActive\xc3"
+                        "\xa7" "balance\xcb\xbf\xf8\x00\x00\x00\x00\x00\x00"
+                        "\xa3" "big\xcf\x00\x00\x00\x01\x00\x00\x00\x00"
+                        "\xa5items\x92\x81\xa4name\xa1" "a\x81\xa4name\xa1" "b"
+                        "\xa4none\xc0"
+                        "\xa4" "flag\xa5" "False";
+    const std::string buffer(data, sizeof(data) - 1);
+
+    const boost::mustache::Template templ("{{name}} {{age}} {{balance}} {{big}}{{#isActive}} active{{/isActive}}:"
+                                          "{{#items}} {{name}}{{/items}}{{^none}} none{{/none}}{{^flag}} off{{/flag}}");
+    boost::mustache::MsgPackContext context(buffer);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &context), "John 30 -1.5 4294967296 active: a b none off");
+
+    // Members cut off by truncation read as missing
+    boost::mustache::MsgPackContext truncated(std::string_view(buffer).substr(0, 40));
+    EXPECT_EQ(renderer.render(templ, &truncated), "John 30   active: none off");
+
+    // Rows are stepped through in order, also when iterated again or nested, and a map with many keys is indexed.
+    // {"title": "t", "rows": [{"id": 0}, ..., {"id": 99}], "wide": {"w0": 0, ..., "w19": 19}}
+    const auto str = [](const std::string &text) { return static_cast<char>(0xa0 | text.size()) + text; };
+    std::string rows = "\x83" + str("title") + str("t") + str("rows") + "\xdc" + std::string(1, '\0') + "\x64";
+    for (int i = 0; i < 100; ++i) {
+        rows += "\x81" + str("id") + static_cast<char>(i);
+    }
+    rows += str("wide") + "\xde" + std::string(1, '\0') + "\x14";
+    for (int i = 0; i < 20; ++i) {
+        rows += str("w" + std::to_string(i)) + static_cast<char>(i);
+    }
+    std::string expected;
+    for (int i = 0; i < 100; ++i) {
+        expected += std::to_string(i) + ",";
+    }
+    const boost::mustache::Template listTempl("{{#rows}}{{id}},{{/rows}}|{{#rows}}{{id}},{{/rows}}|"
+                                              "{{#rows}}{{#rows}}{{id}}{{/rows}}{{/rows}}|"
+                                              "{{#wide}}{{w3}}{{w19}}{{w3}}{{w19}}{{w3}}{{w0}}{{title}}{{/wide}}");
+    boost::mustache::MsgPackContext rowsContext(rows);
+    const std::string nested = renderer.render(boost::mustache::Template("{{#rows}}{{id}}{{/rows}}"), &rowsContext);
+    EXPECT_EQ(renderer.render(listTempl, &rowsContext), expected + "|" + expected + "|" + [&] {
+        std::string repeated;
+        for (int i = 0; i < 100; ++i) {
+            repeated += nested;
+        }
+        return repeated;
+    }() + "|31931930t");
+}
+
+TEST_F(MustacheTest, ColumnarContext)
+{
+    boost::mustache::ColumnarContext context;
+    context.setValue("title", "Orders");
+    context.setValue("currency", "EUR");
+    context.addTable("orders", {{"id", std::vector<int64_t>{1, 2, 3}},
+                                {"total", std::vector<double>{9.5, 12, 0.25}},
+                                {"paid", std::vector<bool>{true, false, true}},
+                                {"note", std::vector<std::string>{"", "late", "False"}}});
+    context.addTable("empty", {{"id", std::vector<int64_t>{}}});
+
+    const boost::mustache::Template templ("{{title}}:{{#orders}} {{id}}={{total}} {{currency}}{{^paid}} unpaid{{/paid}}"
+                                          "{{#note}} ({{.}}){{/note}}{{/orders}}{{^empty}} none{{/empty}}");
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &context), "Orders: 1=9.5 EUR 2=12 EUR unpaid (late) 3=0.25 EUR none");
+
+    // Rows replay the lookups of the first one, a different key in the same position resolves again
+    const boost::mustache::Template varying("{{#orders}}{{#paid}}{{id}}{{/paid}}{{^paid}}{{note}}{{/paid}}"
+                                            "{{total}}{{#orders}}{{id}}{{/orders}};{{/orders}}");
+    EXPECT_EQ(renderer.render(varying, &context), "19.5123;late12123;30.25123;");
+    EXPECT_EQ(renderer.render(varying, &context), "19.5123;late12123;30.25123;");
+
+    context.push("orders", 1);
+    std::string key = "id";
+    EXPECT_EQ(context.stringValue(key), "2");
+    key = "total";
+    EXPECT_EQ(context.stringValue(key), "12");
+    key = "title";
+    EXPECT_EQ(context.stringValue(key), "Orders");
+    context.pop();
+
+    EXPECT_THROW(context.addTable("bad", {{"a", std::vector<int64_t>{1}}, {"b", std::vector<int64_t>{}}}),
+                 std::invalid_argument);
+}
+
+TEST_F(MustacheTest, GeneratorContext)
+{
+    boost::json::object root;
+    root["title"] = "Rows";
+    boost::mustache::GeneratorContext context(root);
+
+    int requested = 0;
+    context.setGenerator("rows", [&requested]() -> std::optional<boost::json::value> {
+        if (requested == 3) {
+            return std::nullopt;
+        }
+        boost::json::object row;
+        row["n"] = requested++;
+        return boost::json::value(std::move(row));
+    });
+    context.setGenerator("none", []() -> std::optional<boost::json::value> { return std::nullopt; });
+
+    const boost::mustache::Template templ("{{title}}:{{#rows}} {{n}}/{{title}}{{/rows}}{{^none}} empty{{/none}}"
+                                          "{{#rows}} again{{/rows}}");
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &context), "Rows: 0/Rows 1/Rows 2/Rows empty");
+    EXPECT_EQ(requested, 3);
+}
+
+TEST_F(MustacheTest, JsonContextLargeObjects)
+{
+    // Objects that Boost.JSON scans linearly get a key index once they are looked into repeatedly, larger ones
+    // are left to Boost.JSON's own
+    boost::json::object root;
+    boost::json::object item;
+    std::string templ;
+    std::string expected;
+    for (int i = 0; i < 40; ++i) {
+        root["k" + std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 12; ++i) {
+        item["f" + std::to_string(i)] = "v" + std::to_string(i);
+    }
+    root["items"] = boost::json::array{item, item};
+    for (int i = 0; i < 40; i += 3) {
+        templ += "{{k" + std::to_string(i) + "}}{{f" + std::to_string(i % 12) + "}}{{missing}}";
+        expected += std::to_string(i) + "v" + std::to_string(i % 12);
+    }
+
+    const boost::mustache::Template compiled("{{#items}}" + templ + "{{/items}}{{k39}}{{f1}}");
+    boost::mustache::JsonContext context(root);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(compiled, &context), expected + expected + "39");
+
+    // Tags carry the hash of their key, and an object pushed again for every element keeps one index
+    EXPECT_EQ(compiled.nodes().back().tag.hash, boost::mustache::keyHash("f1"));
+    root["config"] = item;
+    root["items"] = boost::json::array{1, 2, 3, 4, 5, 6};
+    const boost::mustache::Template nested("{{#items}}{{#config}}{{f2}}{{f10}}{{f2}}{{f10}}{{f2}}{{/config}}{{/items}}");
+    const boost::json::value nestedData(root);
+    boost::mustache::JsonContext nestedContext(&nestedData);
+    std::string nestedExpected;
+    for (int i = 0; i < 6; ++i) {
+        nestedExpected += "v2v10v2v10v2";
+    }
+    EXPECT_EQ(renderer.render(nested, &nestedContext), nestedExpected);
+
+    // Rows past the number of indexes kept evict the oldest ones, each row still finds its own fields
+    boost::json::array rows;
+    std::string rowsExpected;
+    for (int i = 0; i < 200; ++i) {
+        boost::json::object row = item;
+        row["f3"] = i;
+        rows.push_back(std::move(row));
+        rowsExpected += std::to_string(i) + "v1" + std::to_string(i) + "v1" + std::to_string(i) + ",";
+    }
+    const boost::json::value rowsData(boost::json::object{{"rows", rows}});
+    boost::mustache::JsonContext rowsContext(&rowsData);
+    const boost::mustache::Template rowsTempl("{{#rows}}{{f3}}{{f1}}{{f3}}{{f1}}{{f3}},{{/rows}}");
+    EXPECT_EQ(renderer.render(rowsTempl, &rowsContext), rowsExpected);
+    EXPECT_EQ(renderer.render(rowsTempl, &rowsContext), rowsExpected);
+
+    // Generated elements are freed once rendered, their lookups never use an index built for another one
+    int generated = 0;
+    boost::mustache::GeneratorContext generator;
+    generator.setGenerator("rows", [&]() -> std::optional<boost::json::value> {
+        if (generated == 6) {
+            return std::nullopt;
+        }
+        boost::json::object row = item;
+        row["f2"] = generated++;
+        return boost::json::value(std::move(row));
+    });
+    EXPECT_EQ(renderer.render(boost::mustache::Template("{{#rows}}{{f2}}{{f10}}{{f2}}{{f10}}{{f2}}{{/rows}}"),
+                      &generator),
+            "0v100v100" "1v101v101" "2v102v102" "3v103v103" "4v104v104" "5v105v105");
+}
+
+TEST_F(MustacheTest, Truthiness)
+{
+    const std::vector<std::pair<std::string, bool>> values = {{"true", true}, {"false", false}, {"FALSE", false},
+            {"False", false}, {"1", true}, {"0", false}, {" 0 ", false}, {"", false}, {"yes", true}, {"falsey", true}};
+
+    std::string templ;
+    std::string expected;
+    boost::property_tree::ptree tree;
+    for (size_t i = 0; i < values.size(); ++i) {
+        const std::string key = "v" + std::to_string(i);
+        tree.put(key, values[i].first);
+        templ += "{{#" + key + "}}1{{/" + key + "}}{{^" + key + "}}0{{/" + key + "}}";
+        expected += values[i].second ? "1" : "0";
+    }
+
+    const boost::mustache::Template compiled(templ);
+    boost::mustache::PropertyTreeContext treeContext(tree);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(compiled, &treeContext), expected);
+
+    // JSON strings are only false when empty or "false" in any case, numbers are always true
+    boost::json::object json;
+    for (size_t i = 0; i < values.size(); ++i) {
+        json["v" + std::to_string(i)] = values[i].first;
+    }
+    boost::mustache::JsonContext jsonContext(json);
+    EXPECT_EQ(renderer.render(compiled, &jsonContext), "1000111011");
+}
+
+TEST_F(MustacheTest, TypedValues)
+{
+    std::string text;
+    std::string escaped;
+    for (int i = 0; i < 100; ++i) {
+        text += "<b>\"x\"</b> & ";
+        escaped += "&lt;b&gt;&quot;x&quot;&lt;/b&gt; &amp; ";
+    }
+
+    boost::json::object json;
+    json["int"] = -7;
+    json["uint"] = std::numeric_limits<uint64_t>::max();
+    json["double"] = 1.5;
+    json["whole"] = 2.0;
+    json["large"] = 1e20;
+    json["third"] = 1.0 / 3;
+    json["flag"] = true;
+    json["none"] = nullptr;
+    json["text"] = text;
+
+    const boost::mustache::Template templ("{{int}} {{uint}} {{double}} {{whole}} {{large}} {{third}} {{flag}} [{{none}}] "
+                                          "{{text}}|{{{text}}}");
+    boost::mustache::JsonContext context(json);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &context),
+              "-7 18446744073709551615 1.5 2 100000000000000000000 0.333333 true [] " + escaped + "|" + text);
+}
+
+TEST_F(MustacheTest, ResolvedSections)
+{
+    boost::json::value data = {{"items", boost::json::array{{{"name", "a"}}, {{"name", "b"}}, {{"name", "c"}}}},
+                               {"user", {{"name", "John"}}}};
+
+    // Sections look their key up once, however many times they push it
+    const boost::mustache::Template templ("{{#items}}{{name}}{{/items}} {{#user}}{{name}}{{/user}}");
+    boost::mustache::JsonContext context(&data);
+    boost::mustache::Renderer renderer;
+    EXPECT_EQ(renderer.render(templ, &context), "abc John");
+    EXPECT_EQ(renderer.stats().lookups, 6u);
+}
+
+TEST_F(MustacheTest, UnescapeEntities)
+{
+    std::string escaped;
+    std::string expected;
+    for (int i = 0; i < 2000; ++i) {
+        escaped += "&lt;p&gt;&amp;lt;&quot;&&amp;";
+        expected += "<p>&lt;\"&&";
+    }
+
+    boost::json::object json;
+    json["text"] = escaped;
+    json["entities"] = "&copy; &#169; &#xA9; &#0; &bogus; &amp";
+
+    const boost::mustache::Template templ("{{&text}}|{{&entities}}");
+    boost::mustache::JsonContext context(json);
+    boost::mustache::Renderer renderer;
+#ifdef BOOST_MUSTACHE_FULL_ENTITIES
+    EXPECT_EQ(renderer.render(templ, &context), expected + "|\u00a9 \u00a9 \u00a9 &#0; &bogus; &amp");
+#else
+    EXPECT_EQ(renderer.render(templ, &context), expected + "|&copy; &#169; &#xA9; &#0; &bogus; &amp");
+#endif
+    EXPECT_EQ(renderer.stats().bytesCopied, renderer.stats().outputSize);
+}
+
+#ifdef BOOST_MUSTACHE_HAS_COROUTINES
+TEST_F(MustacheTest, RenderGenerator)
+{
+    const boost::mustache::Template templ("Hello {{name}}, you are {{age}}!");
+    boost::mustache::JsonContext context(jsonData);
+
+    std::string result;
+    auto generator = boost::mustache::renderGenerator(templ, &context, 4);
+    for (std::string_view chunk : generator) {
+        EXPECT_LE(chunk.size(), 4u);
+        result += chunk;
+    }
+    EXPECT_EQ(result, "Hello John, you are 30!");
+    EXPECT_FALSE(generator.renderer().errorPos());
+}
+#endif
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+TEST_F(MustacheTest, AsyncRender)
+{
+    boost::json::array items;
+    for (int i = 0; i < 200; ++i) {
+        items.push_back({{"name", "Item" + std::to_string(i)}});
+    }
+    jsonData.as_object()["items"] = items;
+
+    const boost::mustache::Template templ("{{#items}}- {{name}}\n{{/items}}");
+    const std::string expected = boost::mustache::render(templ, jsonData);
+
+    boost::asio::io_context io;
+    boost::asio::local::stream_protocol::socket writer(io), reader(io);
+    boost::asio::local::connect_pair(writer, reader);
+
+    boost::mustache::JsonContext context(jsonData);
+    boost::system::error_code renderError;
+    size_t written = 0;
+    boost::mustache::asyncRender(writer, templ, &context, 64, [&](boost::system::error_code ec, size_t size) {
+        renderError = ec;
+        written = size;
+        writer.close();
+    });
+
+    std::string received;
+    boost::asio::async_read(reader, boost::asio::dynamic_buffer(received), [](boost::system::error_code, size_t) {});
+    io.run();
+
+    EXPECT_FALSE(renderError);
+    EXPECT_EQ(written, expected.size());
+    EXPECT_EQ(received, expected);
+
+    // Move-only completion handlers are accepted
+    boost::asio::local::stream_protocol::socket moveWriter(io), moveReader(io);
+    boost::asio::local::connect_pair(moveWriter, moveReader);
+    size_t movedWritten = 0;
+    boost::mustache::asyncRender(moveWriter, templ, &context, 64,
+            [&, owned = std::make_unique<int>()](boost::system::error_code, size_t size) {
+                movedWritten = size;
+                moveWriter.close();
+            });
+    received.clear();
+    boost::asio::async_read(moveReader, boost::asio::dynamic_buffer(received), [](boost::system::error_code, size_t) {});
+    io.restart();
+    io.run();
+
+    EXPECT_EQ(movedWritten, expected.size());
+    EXPECT_EQ(received, expected);
+}
+
+TEST_F(MustacheTest, AsyncRenderThreaded)
+{
+    boost::json::array items;
+    for (int i = 0; i < 5000; ++i) {
+        items.push_back({{"name", "Item" + std::to_string(i)}});
+    }
+    jsonData.as_object()["items"] = items;
+
+    const boost::mustache::Template templ("{{#items}}- {{name}}\n{{/items}}");
+    const std::string expected = boost::mustache::render(templ, jsonData);
+
+    // Completions of the renders run on whichever thread of the pool is free
+    constexpr int renders = 8;
+    boost::asio::io_context io;
+    std::vector<std::unique_ptr<boost::asio::local::stream_protocol::socket>> writers, readers;
+    std::vector<std::unique_ptr<boost::mustache::JsonContext>> contexts;
+    std::vector<boost::system::error_code> errors(renders);
+    std::vector<size_t> written(renders);
+    std::vector<std::string> received(renders);
+    for (int i = 0; i < renders; ++i) {
+        writers.push_back(std::make_unique<boost::asio::local::stream_protocol::socket>(io));
+        readers.push_back(std::make_unique<boost::asio::local::stream_protocol::socket>(io));
+        boost::asio::local::connect_pair(*writers[i], *readers[i]);
+        // A small send buffer makes writes wait for the reader, so they complete from the reactor
+        writers[i]->set_option(boost::asio::socket_base::send_buffer_size(1024));
+        contexts.push_back(std::make_unique<boost::mustache::JsonContext>(jsonData));
+        boost::mustache::asyncRender(*writers[i], templ, contexts[i].get(), 4096,
+                [&, i](boost::system::error_code ec, size_t size) {
+                    errors[i] = ec;
+                    written[i] = size;
+                    writers[i]->close();
+                });
+        boost::asio::async_read(*readers[i], boost::asio::dynamic_buffer(received[i]),
+                [](boost::system::error_code, size_t) {});
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&io] { io.run(); });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int i = 0; i < renders; ++i) {
+        EXPECT_FALSE(errors[i]);
+        EXPECT_EQ(written[i], expected.size());
+        EXPECT_EQ(received[i], expected);
+    }
+}
+#endif
+
+#ifdef BOOST_MUSTACHE_PROFILING
+TEST_F(MustacheTest, RenderProfiling)
+{
+    jsonData.as_object()["items"] = boost::json::array{{{"name", "Item1"}}, {{"name", "Item2"}}};
+
+    auto profile = std::make_shared<boost::mustache::RenderProfile>();
+    boost::mustache::JsonContext context(jsonData);
+    boost::mustache::Renderer renderer;
+    renderer.setProfiler(profile);
+    EXPECT_EQ(renderer.render("{{#items}}- {{name}}\n{{/items}}", &context), "- Item1\n- Item2\n");
+
+    auto entries = profile->entries();
+    ASSERT_EQ(entries.size(), 2u);
+    EXPECT_EQ(entries[0].key, "items");
+    EXPECT_EQ(entries[0].calls, 1u);
+    EXPECT_EQ(entries[0].iterations, 2u);
+    EXPECT_EQ(entries[0].bytes, 16u);
+    EXPECT_EQ(entries[0].maxDepth, 1u);
+    EXPECT_EQ(entries[1].key, "name");
+    EXPECT_EQ(entries[1].calls, 2u);
+    EXPECT_EQ(entries[1].bytes, 10u);
+    EXPECT_EQ(entries[1].maxDepth, 2u);
+    EXPECT_NE(profile->foldedStacks().find("#items;name "), std::string::npos);
+}
+#endif
+
+#ifdef BOOST_MUSTACHE_HAS_SIMDJSON
+TEST_F(MustacheTest, SimdJsonContext)
+{
+    const boost::mustache::Template templ("{{name}} is {{age}}{{#isActive}}, active{{/isActive}}: "
+                                          "{{#items}}{{name}}={{price}} {{/items}}{{^missing}}!{{/missing}}");
+    const std::string json = R"({"name": "John", "age": 30, "isActive": true,
+        "items": [{"name": "a", "price": 1.5}, {"name": "b", "price": 2}]})";
+
+    simdjson::dom::parser parser;
+    simdjson::dom::element document;
+    ASSERT_EQ(parser.parse(simdjson::padded_string(json)).get(document), simdjson::SUCCESS);
+    EXPECT_EQ(boost::mustache::render(templ, document), "John is 30, active: a=1.5 b=2 !");
+    EXPECT_EQ(boost::mustache::render(templ, document), boost::mustache::render(templ, boost::json::parse(json)));
+
+    // Elements are stepped to from the previous one, also when the same list is iterated again or nested in itself
+    std::string rows = R"({"rows": [)";
+    for (int i = 0; i < 100; ++i) {
+        rows += (i ? "," : "") + std::string(R"({"id": )") + std::to_string(i) + "}";
+    }
+    rows += "]}";
+    const boost::mustache::Template listTempl("{{#rows}}{{id}},{{/rows}}|{{#rows}}{{#id}}{{id}}{{/id}}{{/rows}}|"
+                                              "{{#rows}}{{#rows}}{{id}}{{/rows}};{{/rows}}");
+    simdjson::dom::parser rowsParser;
+    ASSERT_EQ(rowsParser.parse(simdjson::padded_string(rows)).get(document), simdjson::SUCCESS);
+    EXPECT_EQ(boost::mustache::render(listTempl, document),
+            boost::mustache::render(listTempl, boost::json::parse(rows)));
+}
+#endif